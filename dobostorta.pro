@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS += dobostorta torta-dl
+SUBDIRS += dobostorta torta-dl torta-bench
@@ -0,0 +1,2278 @@
+#ifndef DOBOSTORTA_H
+#define DOBOSTORTA_H
+
+#include <QtNetwork>
+#include <QtSql>
+#include <QtWebEngineWidgets>
+#include <QtWidgets>
+
+#include "filter.h"
+#include "request.h"
+
+#define HOMEPAGE    "http://google.com"
+#define USER_AGENT  "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) " \
+                    "Chrome/70.0.0.0 Safari/537.36 Dobostorta/" GIT_VERSION
+
+#define FRECENCY_HALF_LIFE            (30 * 24 * 60 * 60.0)
+#define HISTORY_FLUSH_INTERVAL        500
+#define HISTORY_BATCH_SIZE            256
+#define HISTORY_QUEUE_SIZE            4096
+#define HISTORY_RETENTION_DAYS        365
+#define HISTORY_MAINTENANCE_DELAY     (30 * 1000)
+#define HISTORY_MAINTENANCE_INTERVAL  (10 * 60 * 1000)
+#define HISTORY_PRUNE_CHUNK           500
+#define HISTORY_PRUNE_INTERVAL        1000
+#define HISTORY_VACUUM_PAGES          256
+#define SUGGEST_FIRST                 20
+#define SUGGEST_LIMIT                 500
+#define SCROLL_INTERVAL               16
+#define INTERCEPT_SEEN_LIMIT          100000
+#define LIFECYCLE_INTERVAL            (10 * 1000)
+#define LIFECYCLE_FREEZE_AFTER        (5 * 60)
+#define LIFECYCLE_DISCARD_AFTER       (60 * 60)
+#define PRERENDER_DELAY               300
+#define TRACE_BUFFER_SIZE             (64 * 1024)
+#define SESSION_SAVE_INTERVAL         (60 * 1000)
+#define SESSION_VERSION               1
+#define DOWNLOAD_HANDOFF_TIMEOUT      (60 * 1000)
+#define DOWNLOAD_ACK_TIMEOUT          (5 * 1000)
+
+#define SHORTCUT_META           (Qt::CTRL)
+#define SHORTCUT_FORWARD        QKeySequence(SHORTCUT_META + Qt::Key_I)
+#define SHORTCUT_BACK           QKeySequence(SHORTCUT_META + Qt::Key_O)
+#define SHORTCUT_RELOAD         QKeySequence(SHORTCUT_META + Qt::Key_R)
+#define SHORTCUT_BAR            QKeySequence(SHORTCUT_META + Qt::Key_Colon)
+#define SHORTCUT_BAR_ALT        QKeySequence(SHORTCUT_META + Qt::SHIFT + Qt::Key_Colon)
+#define SHORTCUT_FIND           QKeySequence(SHORTCUT_META + Qt::Key_Slash)
+#define SHORTCUT_ESCAPE         QKeySequence(SHORTCUT_META + Qt::Key_BracketLeft)
+#define SHORTCUT_DOWN           QKeySequence(SHORTCUT_META + Qt::Key_J)
+#define SHORTCUT_UP             QKeySequence(SHORTCUT_META + Qt::Key_K)
+#define SHORTCUT_LEFT           QKeySequence(SHORTCUT_META + Qt::Key_H)
+#define SHORTCUT_RIGHT          QKeySequence(SHORTCUT_META + Qt::Key_L)
+#define SHORTCUT_TOP            QKeySequence(SHORTCUT_META + Qt::Key_G, SHORTCUT_META + Qt::Key_G)
+#define SHORTCUT_BOTTOM         QKeySequence(SHORTCUT_META + Qt::SHIFT + Qt::Key_G)
+#define SHORTCUT_NEXT           QKeySequence(SHORTCUT_META + Qt::Key_N)
+#define SHORTCUT_PREV           QKeySequence(SHORTCUT_META + Qt::Key_P)
+#define SHORTCUT_ZOOMIN         QKeySequence(SHORTCUT_META + Qt::Key_Plus)
+#define SHORTCUT_ZOOMIN_ALT     QKeySequence(SHORTCUT_META + Qt::SHIFT + Qt::Key_Plus)
+#define SHORTCUT_ZOOMOUT        QKeySequence(SHORTCUT_META + Qt::Key_Minus)
+#define SHORTCUT_ZOOMRESET      QKeySequence(SHORTCUT_META + Qt::Key_0)
+#define SHORTCUT_ZOOMSAVE       QKeySequence(SHORTCUT_META + Qt::SHIFT + Qt::Key_Z)
+#define SHORTCUT_LIGHT          QKeySequence(SHORTCUT_META + Qt::SHIFT + Qt::Key_L)
+#define SHORTCUT_NEW_WINDOW     QKeySequence(SHORTCUT_META + Qt::SHIFT + Qt::Key_N)
+#define SHORTCUT_INCOGNITO      QKeySequence(SHORTCUT_META + Qt::SHIFT + Qt::Key_P)
+
+
+inline Q_LOGGING_CATEGORY(tortaHistory,   "dobostorta.history",   QtWarningMsg)
+inline Q_LOGGING_CATEGORY(tortaMemory,    "dobostorta.memory",    QtWarningMsg)
+inline Q_LOGGING_CATEGORY(tortaPrerender, "dobostorta.prerender", QtWarningMsg)
+inline Q_LOGGING_CATEGORY(tortaFilter,    "dobostorta.filter",    QtWarningMsg)
+
+
+class TortaTrace {
+    struct Event {
+        const char *category;
+        const char *name;
+        qint64 begin;
+        qint64 duration;
+        quintptr thread;
+        int detail;
+    };
+
+    struct State {
+        bool enabled = false;
+        bool frozen = false;
+        QElapsedTimer clock;
+        QReadWriteLock lock;
+        QVector<Event> ring;
+        QAtomicInteger<quint64> next = 0;
+        QMutex internLock;
+        QHash<QString, int> detailIds;
+        QStringList details;
+    };
+
+
+    static State &state() {
+        static State s;
+        return s;
+    }
+
+    static int intern(const QString &detail) {
+        if (detail.isEmpty())
+            return -1;
+        State &s = state();
+        QMutexLocker locker(&s.internLock);
+        const auto it = s.detailIds.constFind(detail);
+        if (it != s.detailIds.constEnd())
+            return *it;
+        s.details << detail;
+        return s.detailIds[detail] = s.details.length() - 1;
+    }
+
+    static void record(const char *category, const char *name, qint64 begin, qint64 duration,
+                       int detail) {
+        State &s = state();
+        QReadLocker locker(&s.lock);
+        if (s.frozen)
+            return;
+        Event &e = s.ring[s.next.fetchAndAddRelaxed(1) % s.ring.size()];
+        e = {category, name, begin, duration, quintptr(QThread::currentThreadId()), detail};
+    }
+
+public:
+    class Scope {
+        const char * const category;
+        const char * const name;
+        const qint64 begin;
+
+    public:
+        Scope(const char *category, const char *name)
+                : category(category), name(name), begin(enabled() ? now() : -1) {}
+
+        ~Scope() {
+            if (begin >= 0)
+                record(category, name, begin, now() - begin, -1);
+        }
+    };
+
+
+    static void start(int capacity) {
+        state().ring.resize(capacity);
+        state().clock.start();
+        state().enabled = true;
+    }
+
+    static bool enabled() {
+        return state().enabled;
+    }
+
+    static qint64 now() {
+        return state().clock.nsecsElapsed();
+    }
+
+    static void complete(const char *category, const char *name, qint64 duration,
+                         const QString &detail={}) {
+        if (enabled())
+            record(category, name, now() - duration, duration, intern(detail));
+    }
+
+    static void instant(const char *category, const char *name, const QString &detail={}) {
+        if (enabled())
+            record(category, name, now(), -1, intern(detail));
+    }
+
+    // Stops recording for good, so that threads still running can't write into the ring while
+    // it is being dumped.
+    static bool dump(const QString &path) {
+        State &s = state();
+        {
+            QWriteLocker locker(&s.lock);
+            s.frozen = true;
+        }
+        QMutexLocker locker(&s.internLock);
+        const quint64 count = s.next.loadAcquire();
+        QJsonArray events;
+        for (quint64 i=qMax<quint64>(count, s.ring.size()) - s.ring.size(); i < count; i++) {
+            const Event &e = s.ring[i % s.ring.size()];
+            QJsonObject event{
+                {"cat", e.category}, {"name", e.name}, {"ts", e.begin / 1000.0},
+                {"pid", QCoreApplication::applicationPid()}, {"tid", qint64(e.thread)},
+            };
+            if (e.duration >= 0) {
+                event["ph"] = "X";
+                event["dur"] = e.duration / 1000.0;
+            } else {
+                event["ph"] = "i";
+                event["s"] = "t";
+            }
+            if (e.detail >= 0)
+                event["args"] = QJsonObject{{"detail", s.details[e.detail]}};
+            events << event;
+        }
+
+        const QJsonObject trace{{"traceEvents", events}, {"displayTimeUnit", "ms"}};
+        QFile file(path);
+        return file.open(QIODevice::WriteOnly)
+               && file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact)) >= 0;
+    }
+};
+
+
+enum QueryType {
+    URLWithScheme,
+    URLWithoutScheme,
+    SearchWithScheme,
+    SearchWithoutScheme,
+    InSiteSearch
+};
+
+inline QueryType guessQueryType(const QString &str) {
+    TortaTrace::Scope trace("query", "guessQueryType");
+    if (str.startsWith("search:"))
+        return SearchWithScheme;
+    else if (str.startsWith("find:"))
+        return InSiteSearch;
+    else if (QRegExp("^[^/ \t]+((\\.[^/ \t]+)*\\.[^/0-9 \t]+|:[0-9]+)").indexIn(str) != -1)
+        return URLWithoutScheme;
+    else if (QRegExp("^[a-zA-Z0-9]+:.+").indexIn(str) != -1)
+        return URLWithScheme;
+    else
+        return SearchWithoutScheme;
+}
+
+
+inline QString expandFilePath(const QString &path) {
+    if (path.startsWith("~/"))
+        return QFileInfo(QDir::home(), path.mid(3)).absoluteFilePath();
+    else
+        return QFileInfo(QDir::current(), path).absoluteFilePath();
+}
+
+
+// log2 of the sum of 2^(timestamp / half-life) over every visit; comparable without decay.
+inline double frecency(double score, qint64 timestamp) {
+    const double visit = timestamp / FRECENCY_HALF_LIFE;
+    if (score <= 0)
+        return visit;
+    return qMax(score, visit) + std::log2(1 + std::exp2(-qAbs(score - visit)));
+}
+
+
+inline qint64 residentKB(qint64 pid) {
+    QFile status(QString("/proc/%1/status").arg(pid));
+    if (pid <= 0 || !status.open(QIODevice::ReadOnly))
+        return 0;
+    for (QByteArray line; !(line = status.readLine()).isEmpty(); ) {
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).simplified().split(' ').first().toLongLong();
+    }
+    return 0;
+}
+
+
+class TortaPrefixIndex {
+    struct Entry {
+        QString text;
+        double score;
+        qint64 visited;
+    };
+
+    struct Node {
+        QString label;
+        QVector<int> children;
+        int best;
+        QVector<int> ends;
+    };
+
+    QVector<Entry> entries;
+    QVector<Node> nodes{Node{"", {}, -1, {}}};
+    QHash<QString, QVector<int>> uris;
+
+
+    static QStringList keys(const QString &scheme, const QString &address) {
+        if (scheme == "search")
+            return {address};
+        else if (scheme == "file")
+            return {};
+
+        QStringList r{address.mid(2)};
+        if ((scheme == "http" || scheme == "https") && address.startsWith("//www."))
+            r << address.mid(6);
+        return r;
+    }
+
+    int childOf(int node, QChar c) const {
+        for (int child: nodes[node].children) {
+            if (nodes[child].label[0] == c)
+                return child;
+        }
+        return -1;
+    }
+
+    void promote(int node, int entry) {
+        if (nodes[node].best < 0 || entries[nodes[node].best].score < entries[entry].score)
+            nodes[node].best = entry;
+    }
+
+    void insert(const QString &key, int entry) {
+        int node = 0;
+        promote(node, entry);
+        for (int pos=0; pos < key.length(); ) {
+            const int child = childOf(node, key[pos]);
+            if (child < 0) {
+                nodes.append(Node{key.mid(pos), {}, entry, {entry}});
+                nodes[node].children.append(nodes.length() - 1);
+                return;
+            }
+
+            const QString label(nodes[child].label);
+            int common = 1;
+            while (common < label.length() && pos + common < key.length()
+                   && label[common] == key[pos + common])
+                common++;
+
+            if (common < label.length()) {
+                nodes.append(Node{label.mid(common), nodes[child].children, nodes[child].best,
+                                  nodes[child].ends});
+                nodes[child].label.truncate(common);
+                nodes[child].children = {nodes.length() - 1};
+                nodes[child].ends.clear();
+            }
+            promote(child, entry);
+            node = child;
+            pos += common;
+        }
+        if (!nodes[node].ends.contains(entry))
+            nodes[node].ends << entry;
+    }
+
+    void repair(int node) {
+        int best = -1;
+        for (int entry: nodes[node].ends) {
+            if (best < 0 || entries[best].score < entries[entry].score)
+                best = entry;
+        }
+        for (int child: nodes[node].children) {
+            const int entry = nodes[child].best;
+            if (entry >= 0 && (best < 0 || entries[best].score < entries[entry].score))
+                best = entry;
+        }
+        nodes[node].best = best;
+    }
+
+    const QVector<int> &entriesOf(const QString &scheme, const QString &address) {
+        QVector<int> &ids = uris[scheme + ":" + address];
+        if (ids.isEmpty()) {
+            for (const QString &key: keys(scheme, address)) {
+                entries.append({key, 0, 0});
+                ids << entries.length() - 1;
+            }
+        }
+        return ids;
+    }
+
+public:
+    void add(const QString &scheme, const QString &address, double score, qint64 visited) {
+        for (int id: entriesOf(scheme, address)) {
+            entries[id].score = qMax(entries[id].score, score);
+            entries[id].visited = qMax(entries[id].visited, visited);
+            insert(entries[id].text.toLower(), id);
+        }
+    }
+
+    void visit(const QString &scheme, const QString &address, qint64 timestamp) {
+        for (int id: entriesOf(scheme, address)) {
+            entries[id].score = frecency(entries[id].score, timestamp);
+            entries[id].visited = qMax(entries[id].visited, timestamp);
+            insert(entries[id].text.toLower(), id);
+        }
+    }
+
+    // Removes the URI unless it was visited after the given time.
+    void remove(const QString &scheme, const QString &address, qint64 before) {
+        const auto it = uris.constFind(scheme + ":" + address);
+        if (it == uris.constEnd())
+            return;
+        for (int id: *it) {
+            if (entries[id].visited > before)
+                return;
+        }
+
+        for (int id: uris.take(scheme + ":" + address)) {
+            const QString key(entries[id].text.toLower());
+            entries[id] = {QString(), -1, 0};
+
+            QVector<int> path{0};
+            for (int pos=0; pos < key.length(); ) {
+                const int child = childOf(path.last(), key[pos]);
+                if (child < 0)
+                    break;
+                path << child;
+                pos += nodes[child].label.length();
+            }
+            nodes[path.last()].ends.removeAll(id);
+            for (int i=path.length() - 1; i >= 0; i--)
+                repair(path[i]);
+        }
+    }
+
+    QString find(const QString &prefix) const {
+        const QString key(prefix.toLower());
+        int node = 0;
+        for (int pos=0; pos < key.length(); ) {
+            node = childOf(node, key[pos]);
+            if (node < 0)
+                return "";
+
+            const QString &label = nodes[node].label;
+            for (int i=1; i < label.length() && pos + i < key.length(); i++) {
+                if (label[i] != key[pos + i])
+                    return "";
+            }
+            pos += label.length();
+        }
+        return nodes[node].best < 0 ? "" : entries[nodes[node].best].text;
+    }
+};
+
+
+struct TortaHost {
+    QString scheme;
+    bool www;
+    bool https;
+    qint64 visited;
+
+
+    static QString key(const QString &scheme, const QString &address, bool *www) {
+        if (scheme != "http" && scheme != "https")
+            return {};
+        const QString host(QUrl(scheme + ":" + address).host());
+        *www = host.startsWith("www.");
+        return *www ? host.mid(4) : host;
+    }
+};
+
+
+struct TortaSite {
+    bool javascript;
+    bool images;
+    bool autoplay;
+    bool acceleration;
+    qreal zoom;
+
+
+    static TortaSite defaults() {
+        return {true, true, true, true, 0};
+    }
+
+    static TortaSite light(qreal zoom) {
+        return {false, false, false, false, zoom};
+    }
+
+    bool isDefault() const {
+        return javascript && images && autoplay && acceleration && zoom <= 0;
+    }
+
+    void apply(QWebEnginePage *page, bool zoomed=true) const {
+        QWebEngineSettings * const settings = page->settings();
+        settings->setAttribute(QWebEngineSettings::JavascriptEnabled, javascript);
+        settings->setAttribute(QWebEngineSettings::AutoLoadImages, images);
+        settings->setAttribute(QWebEngineSettings::PlaybackRequiresUserGesture, !autoplay);
+        settings->setAttribute(QWebEngineSettings::WebGLEnabled, acceleration);
+        settings->setAttribute(QWebEngineSettings::Accelerated2dCanvasEnabled, acceleration);
+        if (zoomed && zoom > 0)
+            page->setZoomFactor(zoom);
+    }
+};
+
+
+class TortaHistoryWriter : public QThread {
+public:
+    typedef QVector<QPair<QString, QString>> URLs;
+    typedef std::function<void(const URLs &, const QStringList &, qint64)> Pruned;
+
+private:
+    struct Visit {
+        QString scheme;
+        QString address;
+        qint64 timestamp;
+    };
+
+    struct SiteChange {
+        QString host;
+        TortaSite site;
+    };
+
+    const QString path;
+    const int retention;
+    const Pruned pruned;
+    QMutex mutex;
+    QWaitCondition pushed;
+    QWaitCondition popped;
+    QVector<Visit> queue;
+    QVector<SiteChange> siteQueue;
+    bool writing = false;
+    bool flushing = false;
+    bool stopping = false;
+
+
+    bool idle() const {
+        return queue.isEmpty() && siteQueue.isEmpty();
+    }
+
+    void write(QSqlDatabase &db, const QVector<Visit> &batch, const QVector<SiteChange> &sites) {
+        TortaTrace::Scope trace("db", "write");
+        QSqlQuery score(db), add(db), visit(db), host(db);
+        score.prepare("SELECT frecency FROM urls WHERE scheme = :scheme AND address = :address");
+        add.prepare("INSERT INTO urls (scheme, address, visit_count, last_visit, frecency)      \
+                       VALUES (:scheme, :address, 1, :timestamp, :frecency)                   \
+                     ON CONFLICT (scheme, address) DO UPDATE                                  \
+                       SET visit_count = visit_count + 1, last_visit = excluded.last_visit,   \
+                           frecency = excluded.frecency                                       ");
+        visit.prepare("INSERT INTO visits (url_id, timestamp)                                 \
+                         SELECT id, :timestamp FROM urls                                      \
+                         WHERE scheme = :scheme AND address = :address                        ");
+        host.prepare("INSERT INTO hosts (host, scheme, www, https)                            \
+                        VALUES (:host, :scheme, :www, :https)                                 \
+                      ON CONFLICT (host) DO UPDATE                                            \
+                        SET scheme = excluded.scheme, www = excluded.www,                     \
+                            https = https OR excluded.https                                   ");
+
+        db.transaction();
+        for (const Visit &v: batch) {
+            score.bindValue(":scheme", v.scheme);
+            score.bindValue(":address", v.address);
+            const double f = frecency(score.exec() && score.next() ? score.value(0).toDouble() : 0,
+                                      v.timestamp);
+            score.finish();
+
+            add.bindValue(":scheme", v.scheme);
+            add.bindValue(":address", v.address);
+            add.bindValue(":timestamp", v.timestamp);
+            add.bindValue(":frecency", f);
+            add.exec();
+
+            visit.bindValue(":scheme", v.scheme);
+            visit.bindValue(":address", v.address);
+            visit.bindValue(":timestamp", v.timestamp);
+            visit.exec();
+
+            bool www;
+            const QString key(TortaHost::key(v.scheme, v.address, &www));
+            if (!key.isEmpty()) {
+                host.bindValue(":host", key);
+                host.bindValue(":scheme", v.scheme);
+                host.bindValue(":www", www);
+                host.bindValue(":https", v.scheme == "https");
+                host.exec();
+            }
+        }
+
+        QSqlQuery save(db), reset(db);
+        save.prepare("INSERT OR REPLACE INTO sites                                   \
+                        (host, javascript, images, autoplay, acceleration, zoom)    \
+                      VALUES (?, ?, ?, ?, ?, ?)                                     ");
+        reset.prepare("DELETE FROM sites WHERE host = ?");
+        for (const SiteChange &c: sites) {
+            if (c.site.isDefault()) {
+                reset.addBindValue(c.host);
+                reset.exec();
+                continue;
+            }
+            save.addBindValue(c.host);
+            save.addBindValue(c.site.javascript);
+            save.addBindValue(c.site.images);
+            save.addBindValue(c.site.autoplay);
+            save.addBindValue(c.site.acceleration);
+            save.addBindValue(c.site.zoom);
+            save.exec();
+        }
+        db.commit();
+    }
+
+    static bool hostVisited(QSqlDatabase &db, const QString &key) {
+        QSqlQuery query(db);
+        query.prepare("SELECT scheme, address FROM urls WHERE scheme IN ('http', 'https')  \
+                         AND ((address >= ? AND address < ?)                             \
+                              OR (address >= ? AND address < ?))                         ");
+        for (const QString &prefix: {"//" + key, "//www." + key}) {
+            query.addBindValue(prefix);
+            query.addBindValue(prefix + QChar(0xffff));
+        }
+
+        bool www;
+        for (query.exec(); query.next(); ) {
+            if (TortaHost::key(query.value(0).toString(), query.value(1).toString(), &www) == key)
+                return true;
+        }
+        return false;
+    }
+
+    bool prune(QSqlDatabase &db) {
+        if (retention <= 0)
+            return false;
+
+        TortaTrace::Scope trace("db", "prune");
+        QSqlQuery old(db);
+        old.prepare("SELECT rowid, url_id FROM visits WHERE timestamp < ?  \
+                     ORDER BY timestamp LIMIT ?                          ");
+        const qint64 cutoff = QDateTime::currentDateTime().addDays(-retention).toSecsSinceEpoch();
+        old.addBindValue(cutoff);
+        old.addBindValue(HISTORY_PRUNE_CHUNK);
+
+        QStringList rowids;
+        QHash<qint64, int> counts;
+        for (old.exec(); old.next(); ) {
+            rowids << old.value(0).toString();
+            counts[old.value(1).toLongLong()]++;
+        }
+        old.finish();
+        if (rowids.isEmpty())
+            return false;
+
+        db.transaction();
+        QSqlQuery update(db);
+        update.prepare("UPDATE urls SET visit_count = visit_count - ? WHERE id = ?");
+        for (auto it = counts.constBegin(); it != counts.constEnd(); it++) {
+            update.addBindValue(it.value());
+            update.addBindValue(it.key());
+            update.exec();
+        }
+        db.exec("DELETE FROM visits WHERE rowid IN (" + rowids.join(",") + ")");
+
+        QStringList ids;
+        for (auto it = counts.constBegin(); it != counts.constEnd(); it++)
+            ids << QString::number(it.key());
+        QSqlQuery gone("SELECT id, scheme, address FROM urls                 \
+                        WHERE visit_count <= 0 AND id IN (" + ids.join(",") + ")", db);
+        QStringList goneIds;
+        URLs urls;
+        QSet<QString> candidates;
+        for (gone.exec(); gone.next(); ) {
+            goneIds << gone.value(0).toString();
+            urls << qMakePair(gone.value(1).toString(), gone.value(2).toString());
+
+            bool www;
+            const QString key(TortaHost::key(urls.last().first, urls.last().second, &www));
+            if (!key.isEmpty())
+                candidates << key;
+        }
+        gone.finish();
+        if (!goneIds.isEmpty())
+            db.exec("DELETE FROM urls WHERE id IN (" + goneIds.join(",") + ")");
+
+        QStringList hosts;
+        QSqlQuery forget(db);
+        forget.prepare("DELETE FROM hosts WHERE host = ?");
+        for (const QString &key: candidates) {
+            if (!hostVisited(db, key)) {
+                forget.addBindValue(key);
+                forget.exec();
+                hosts << key;
+            }
+        }
+        db.commit();
+
+        if (!urls.isEmpty()) {
+            QMetaObject::invokeMethod(this, [this, urls, hosts, cutoff]{
+                pruned(urls, hosts, cutoff);
+            }, Qt::QueuedConnection);
+        }
+
+        return rowids.length() == HISTORY_PRUNE_CHUNK;
+    }
+
+    void compact(QSqlDatabase &db) {
+        TortaTrace::Scope trace("db", "compact");
+        auto pragma = [&](const QString &name){
+            QSqlQuery query("PRAGMA " + name, db);
+            return query.next() ? query.value(0).toLongLong() : 0;
+        };
+
+        db.exec(QString("PRAGMA incremental_vacuum(%1)").arg(HISTORY_VACUUM_PAGES));
+        db.exec("PRAGMA optimize");
+
+        const qint64 pages = pragma("page_count");
+        qCInfo(tortaHistory) << "size:" << pages * pragma("page_size") << "bytes,"
+                             << "free pages:" << pragma("freelist_count") << "/" << pages;
+    }
+
+    void run() override {
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "torta-writer");
+            db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+            db.setDatabaseName(path);
+            db.open();
+            db.exec("PRAGMA synchronous = NORMAL");
+
+            QDeadlineTimer maintenance(HISTORY_MAINTENANCE_DELAY);
+            QMutexLocker locker(&mutex);
+            while (!stopping || !idle()) {
+                if (idle() && maintenance.hasExpired()) {
+                    locker.unlock();
+                    const bool remains = prune(db);
+                    if (!remains)
+                        compact(db);
+                    maintenance.setRemainingTime(remains ? HISTORY_PRUNE_INTERVAL
+                                                         : HISTORY_MAINTENANCE_INTERVAL);
+                    locker.relock();
+                    continue;
+                } else if (idle()) {
+                    if (!stopping)
+                        pushed.wait(&mutex, maintenance);
+                    continue;
+                }
+
+                QDeadlineTimer deadline(HISTORY_FLUSH_INTERVAL);
+                while (!stopping && !flushing && siteQueue.isEmpty()
+                       && queue.length() < HISTORY_BATCH_SIZE && !deadline.hasExpired())
+                    pushed.wait(&mutex, deadline);
+
+                QVector<Visit> batch;
+                QVector<SiteChange> sites;
+                batch.swap(queue);
+                sites.swap(siteQueue);
+                writing = true;
+                popped.wakeAll();
+                locker.unlock();
+
+                write(db, batch, sites);
+                if (maintenance.remainingTime() < HISTORY_MAINTENANCE_DELAY)
+                    maintenance.setRemainingTime(HISTORY_MAINTENANCE_DELAY);
+
+                locker.relock();
+                writing = false;
+                popped.wakeAll();
+            }
+        }
+        QSqlDatabase::removeDatabase("torta-writer");
+    }
+
+public:
+    TortaHistoryWriter(const QString &path, int retention,
+                       const Pruned &pruned)
+            : path(path), retention(retention), pruned(pruned) {}
+
+    ~TortaHistoryWriter() {
+        stop();
+    }
+
+    void push(const QString &scheme, const QString &address, qint64 timestamp) {
+        QMutexLocker locker(&mutex);
+        while (queue.length() >= HISTORY_QUEUE_SIZE)
+            popped.wait(&mutex);
+        queue.append({scheme, address, timestamp});
+        pushed.wakeOne();
+    }
+
+    void push(const QString &host, const TortaSite &site) {
+        QMutexLocker locker(&mutex);
+        siteQueue.append({host, site});
+        pushed.wakeOne();
+    }
+
+    void flush() {
+        QMutexLocker locker(&mutex);
+        flushing = true;
+        pushed.wakeOne();
+        while (isRunning() && (!idle() || writing))
+            popped.wait(&mutex);
+        flushing = false;
+    }
+
+    void stop() {
+        {
+            QMutexLocker locker(&mutex);
+            stopping = true;
+            pushed.wakeOne();
+        }
+        wait();
+    }
+};
+
+
+class TortaHistoryReader : public QThread {
+    struct Job {
+        QPointer<QObject> receiver;
+        QStringList query;
+        std::function<void(int, const QStringList &)> ready;
+    };
+
+    const QString path;
+    QMutex mutex;
+    QWaitCondition requested;
+    QHash<QObject *, Job> jobs;
+    bool stopping = false;
+
+
+    static QString escapeLike(QString str) {
+        return str.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+    }
+
+    bool superseded(QObject *receiver) {
+        QMutexLocker locker(&mutex);
+        return stopping || jobs.contains(receiver);
+    }
+
+    void post(const Job &job, int offset, const QStringList &rows) {
+        QMetaObject::invokeMethod(this, [job, offset, rows]{
+            if (job.receiver)
+                job.ready(offset, rows);
+        }, Qt::QueuedConnection);
+    }
+
+    void run() override {
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "torta-reader");
+            db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000;QSQLITE_OPEN_READONLY");
+            db.setDatabaseName(path);
+            db.open();
+            const bool fullText = db.tables().contains("urls_search");
+
+            QMutexLocker locker(&mutex);
+            while (!stopping) {
+                if (jobs.isEmpty()) {
+                    requested.wait(&mutex);
+                    continue;
+                }
+
+                QObject * const receiver = jobs.begin().key();
+                const Job job = jobs.take(receiver);
+                locker.unlock();
+
+                post(job, 0, search(db, fullText, job.query, SUGGEST_FIRST));
+                if (!superseded(receiver))
+                    post(job, SUGGEST_FIRST, search(db, fullText, job.query,
+                                                    SUGGEST_LIMIT - SUGGEST_FIRST, SUGGEST_FIRST));
+
+                locker.relock();
+            }
+        }
+        QSqlDatabase::removeDatabase("torta-reader");
+    }
+
+public:
+    TortaHistoryReader(const QString &path) : path(path) {}
+
+    ~TortaHistoryReader() {
+        stop();
+    }
+
+    static QStringList search(const QSqlDatabase &db, bool fullText, const QStringList &query,
+                              int limit, int offset=0) {
+        TortaTrace::Scope trace("db", "search");
+        QStringList indexed, scanned;
+        for (const QString &q: query) {
+            if (fullText && q.length() >= 3)
+                indexed << "\"" + QString(q).replace("\"", "\"\"") + "\"";
+            else
+                scanned << escapeLike(q);
+        }
+
+        if (indexed.isEmpty() && scanned.isEmpty())
+            return {};
+
+        QStringList where;
+        if (!indexed.isEmpty())
+            where << "id IN (SELECT rowid FROM urls_search WHERE urls_search MATCH ?)";
+        for (int i=0; i<scanned.length(); i++)
+            where << "address LIKE ? ESCAPE '\\'";
+
+        QSqlQuery search(QString("SELECT scheme||':'||address AS uri FROM urls WHERE %1  \
+                                  ORDER BY frecency DESC LIMIT %2 OFFSET %3")
+                             .arg(where.join(" AND ")).arg(limit).arg(offset), db);
+        if (!indexed.isEmpty())
+            search.addBindValue(indexed.join(" AND "));
+        for (const QString &q: scanned)
+            search.addBindValue("%" + q + "%");
+
+        QStringList r;
+        for (search.exec(); search.next(); )
+            r << search.value("uri").toString();
+        search.finish();
+        return r;
+    }
+
+    void request(QObject *receiver, const QStringList &query,
+                 const std::function<void(int, const QStringList &)> &ready) {
+        QMutexLocker locker(&mutex);
+        jobs.insert(receiver, {receiver, query, ready});
+        requested.wakeOne();
+    }
+
+    void stop() {
+        {
+            QMutexLocker locker(&mutex);
+            stopping = true;
+            requested.wakeOne();
+        }
+        wait();
+    }
+};
+
+
+class TortaDatabase {
+    QSqlDatabase db;
+    TortaHistoryWriter writer;
+    TortaHistoryReader reader;
+    bool fullText;
+    TortaPrefixIndex prefix;
+    QHash<QString, TortaHost> hosts;
+    QHash<QString, TortaSite> sites;
+    QHash<QString, TortaSite> incognitoSites;
+
+
+    bool exists(const QString &name) {
+        QSqlQuery query(db);
+        query.prepare("SELECT 1 FROM sqlite_master WHERE name = ?");
+        query.addBindValue(name);
+        return query.exec() && query.next();
+    }
+
+    void setupVacuum() {
+        db.exec("PRAGMA auto_vacuum = INCREMENTAL");
+        QSqlQuery mode("PRAGMA auto_vacuum", db);
+        if (mode.next() && mode.value(0).toInt() != 2) {
+            mode.finish();
+            db.exec("VACUUM");
+        }
+    }
+
+    void setupSchema() {
+        db.exec("CREATE TABLE IF NOT EXISTS urls                                \
+                   (id INTEGER PRIMARY KEY, scheme TEXT NOT NULL,               \
+                    address TEXT NOT NULL, visit_count INTEGER NOT NULL,        \
+                    last_visit INTEGER NOT NULL, frecency REAL NOT NULL,        \
+                    UNIQUE (scheme, address))                                   ");
+        db.exec("CREATE INDEX IF NOT EXISTS urls_frecency ON urls(frecency)");
+        db.exec("CREATE TABLE IF NOT EXISTS visits                              \
+                   (url_id INTEGER NOT NULL, timestamp INTEGER NOT NULL)        ");
+        db.exec("CREATE INDEX IF NOT EXISTS visits_timestamp ON visits(timestamp)");
+        db.exec("CREATE TABLE IF NOT EXISTS hosts                               \
+                   (host TEXT PRIMARY KEY, scheme TEXT NOT NULL,                \
+                    www INTEGER NOT NULL, https INTEGER NOT NULL) WITHOUT ROWID ");
+        db.exec("CREATE TABLE IF NOT EXISTS sites                               \
+                   (host TEXT PRIMARY KEY, javascript INTEGER NOT NULL,         \
+                    images INTEGER NOT NULL, autoplay INTEGER NOT NULL,         \
+                    acceleration INTEGER NOT NULL, zoom REAL NOT NULL)          \
+                 WITHOUT ROWID                                                  ");
+    }
+
+    void migrateHistory() {
+        if (!exists("history"))
+            return;
+
+        db.transaction();
+        db.exec("INSERT OR IGNORE INTO urls                                               \
+                   SELECT NULL, scheme, address, COUNT(timestamp),                        \
+                          CAST(STRFTIME('%s', MAX(timestamp)) AS INTEGER), 0              \
+                   FROM history GROUP BY scheme, address                                  ");
+        db.exec("INSERT INTO visits                                                       \
+                   SELECT urls.id, CAST(STRFTIME('%s', history.timestamp) AS INTEGER)     \
+                   FROM history JOIN urls USING (scheme, address) ORDER BY history.timestamp");
+
+        QHash<qint64, double> scores;
+        QSqlQuery visits("SELECT url_id, timestamp FROM visits", db);
+        for (visits.exec(); visits.next(); ) {
+            double &s = scores[visits.value(0).toLongLong()];
+            s = frecency(s, visits.value(1).toLongLong());
+        }
+        visits.finish();
+
+        QSqlQuery update(db);
+        update.prepare("UPDATE urls SET frecency = ? WHERE id = ?");
+        for (auto it = scores.constBegin(); it != scores.constEnd(); it++) {
+            update.addBindValue(it.value());
+            update.addBindValue(it.key());
+            update.exec();
+        }
+
+        db.exec("DROP TABLE IF EXISTS history_search");
+        db.exec("DROP TABLE history");
+        db.commit();
+        db.exec("VACUUM");
+    }
+
+    void setupFullText() {
+        const bool created = exists("urls_search");
+
+        fullText = !db.exec("CREATE VIRTUAL TABLE IF NOT EXISTS urls_search                  \
+                               USING fts5(address, content='urls', content_rowid='id',    \
+                                          tokenize='trigram')                             ")
+                       .lastError().isValid();
+        if (!fullText)
+            return;
+
+        db.exec("CREATE TRIGGER IF NOT EXISTS urls_search_insert AFTER INSERT ON urls  \
+                 BEGIN INSERT INTO urls_search (rowid, address)                        \
+                       VALUES (new.id, new.address); END");
+        db.exec("CREATE TRIGGER IF NOT EXISTS urls_search_delete AFTER DELETE ON urls  \
+                 BEGIN INSERT INTO urls_search (urls_search, rowid, address)           \
+                       VALUES ('delete', old.id, old.address); END");
+        if (!created)
+            db.exec("INSERT INTO urls_search (urls_search) VALUES ('rebuild')");
+    }
+
+    void loadHosts() {
+        QSqlQuery load("SELECT host, scheme, www, https FROM hosts", db);
+        for (load.exec(); load.next(); ) {
+            const TortaHost host{load.value(1).toString(), load.value(2).toBool(),
+                                 load.value(3).toBool(), 0};
+            hosts.insert(load.value(0).toString(), host);
+        }
+        if (!hosts.isEmpty())
+            return;
+
+        QSqlQuery urls("SELECT scheme, address FROM urls WHERE scheme IN ('http', 'https')  \
+                        ORDER BY last_visit                                                ", db);
+        for (urls.exec(); urls.next(); )
+            learnHost(urls.value(0).toString(), urls.value(1).toString());
+
+        db.transaction();
+        QSqlQuery save(db);
+        save.prepare("INSERT INTO hosts (host, scheme, www, https) VALUES (?, ?, ?, ?)");
+        for (auto it = hosts.constBegin(); it != hosts.constEnd(); it++) {
+            save.addBindValue(it.key());
+            save.addBindValue(it->scheme);
+            save.addBindValue(it->www);
+            save.addBindValue(it->https);
+            save.exec();
+        }
+        db.commit();
+    }
+
+    void learnHost(const QString &scheme, const QString &address, qint64 timestamp=0) {
+        bool www;
+        const QString key(TortaHost::key(scheme, address, &www));
+        if (!key.isEmpty()) {
+            const bool https = hosts.value(key).https || scheme == "https";
+            hosts.insert(key, {scheme, www, https, timestamp});
+        }
+    }
+
+    void loadSites() {
+        QSqlQuery load("SELECT host, javascript, images, autoplay, acceleration, zoom FROM sites",
+                       db);
+        for (load.exec(); load.next(); ) {
+            const TortaSite site{load.value(1).toBool(), load.value(2).toBool(),
+                                 load.value(3).toBool(), load.value(4).toBool(),
+                                 load.value(5).toDouble()};
+            sites.insert(load.value(0).toString(), site);
+        }
+    }
+
+    void loadPrefixIndex() {
+        QSqlQuery load("SELECT scheme, address, frecency, last_visit FROM urls", db);
+        for (load.exec(); load.next(); )
+            prefix.add(load.value(0).toString(), load.value(1).toString(),
+                       load.value(2).toDouble(), load.value(3).toLongLong());
+    }
+
+    // The writer prunes in the background, so anything visited since its cutoff is kept.
+    void forget(const TortaHistoryWriter::URLs &urls, const QStringList &gone, qint64 cutoff) {
+        for (const auto &url: urls)
+            prefix.remove(url.first, url.second, cutoff);
+        for (const QString &host: gone) {
+            if (hosts.value(host).visited <= cutoff)
+                hosts.remove(host);
+        }
+    }
+
+    static QString path() {
+        return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/history";
+    }
+
+public:
+    TortaDatabase(int retention=HISTORY_RETENTION_DAYS, const QString &file=path())
+            : db(QSqlDatabase::addDatabase("QSQLITE")),
+              writer(file, retention, [this](const TortaHistoryWriter::URLs &urls,
+                                             const QStringList &hosts, qint64 cutoff){
+                  forget(urls, hosts, cutoff);
+              }),
+              reader(file) {
+        db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+        db.setDatabaseName(file);
+        db.open();
+        setupVacuum();
+        db.exec("PRAGMA journal_mode = WAL");
+
+        setupSchema();
+        migrateHistory();
+        setupFullText();
+        loadPrefixIndex();
+        loadHosts();
+        loadSites();
+
+        writer.start();
+        reader.start();
+    }
+
+    ~TortaDatabase() {
+        reader.stop();
+        writer.stop();
+        db.close();
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+    }
+
+    void append(const QString &scheme, const QString &address) {
+        const qint64 timestamp = QDateTime::currentSecsSinceEpoch();
+        writer.push(scheme, address, timestamp);
+        prefix.visit(scheme, address, timestamp);
+        learnHost(scheme, address, timestamp);
+    }
+
+    void flush() {
+        writer.flush();
+    }
+
+    QStringList search(const QStringList &query, int limit=SUGGEST_LIMIT) const {
+        return TortaHistoryReader::search(db, fullText, query, limit);
+    }
+
+    void suggest(QObject *receiver, const QStringList &query,
+                 const std::function<void(int, const QStringList &)> &ready) {
+        reader.request(receiver, query, ready);
+    }
+
+    QString firstForwardMatch(const QString &query) const {
+        TortaTrace::Scope trace("db", "firstForwardMatch");
+        return prefix.find(query);
+    }
+
+    TortaSite site(const QString &host, bool incognito) const {
+        if (incognito && incognitoSites.contains(host))
+            return incognitoSites.value(host);
+        return sites.value(host, TortaSite::defaults());
+    }
+
+    void setSite(const QString &host, const TortaSite &site, bool incognito) {
+        if (incognito) {
+            incognitoSites.insert(host, site);
+            return;
+        }
+
+        if (site.isDefault())
+            sites.remove(host);
+        else
+            sites.insert(host, site);
+        writer.push(host, site);
+    }
+
+    QString expandAbridgedAddress(const QString &addr) const {
+        TortaTrace::Scope trace("db", "expandAbridgedAddress");
+        QUrl url("http://" + addr);
+        const bool typedWWW = url.host().startsWith("www.");
+        const auto host = hosts.constFind(typedWWW ? url.host().mid(4) : url.host());
+        if (host == hosts.constEnd())
+            return "http://" + addr;
+
+        url.setScheme(host->https ? "https" : host->scheme);
+        if (host->www && !typedWWW)
+            url.setHost("www." + url.host());
+        return url.toString();
+    }
+};
+
+
+class TortaSuggestModel : public QAbstractListModel {
+    QVector<QString> rows;
+
+public:
+    TortaSuggestModel(QObject *parent) : QAbstractListModel(parent) {
+        rows.reserve(SUGGEST_LIMIT + 8);
+    }
+
+    int rowCount(const QModelIndex &parent={}) const override {
+        return parent.isValid() ? 0 : rows.length();
+    }
+
+    QVariant data(const QModelIndex &index, int role=Qt::DisplayRole) const override {
+        if (!index.isValid() || (role != Qt::DisplayRole && role != Qt::EditRole))
+            return {};
+        return rows[index.row()];
+    }
+
+    void setRows(int from, const QStringList &list) {
+        from = qMin(from, rows.length());
+        const int end = from + list.length();
+
+        if (end < rows.length()) {
+            beginRemoveRows({}, end, rows.length() - 1);
+            rows.resize(end);
+            endRemoveRows();
+        }
+
+        const int changed = qMin(end, rows.length());
+        for (int i=from; i < changed; i++)
+            rows[i] = list[i - from];
+        if (from < changed)
+            emit dataChanged(index(from), index(changed - 1));
+
+        if (changed < end) {
+            beginInsertRows({}, changed, end - 1);
+            for (int i=changed; i < end; i++)
+                rows.append(list[i - from]);
+            endInsertRows();
+        }
+    }
+};
+
+
+template <class Torta> class TortaBar : public QLineEdit {
+    TortaSuggestModel model;
+    QListView suggest;
+    Torta * const parent;
+    int generation = 0;
+
+
+    void keyPressEvent(QKeyEvent *e) override {
+        if (e->key() == Qt::Key_Escape || QKeySequence(e->key()+e->modifiers()) == SHORTCUT_ESCAPE)
+            close();
+        else if (!parent->executeShortcuts(e))
+            QLineEdit::keyPressEvent(e);
+    }
+
+    bool eventFilter(QObject *obj, QEvent *e) override {
+        if (obj == &suggest && e->type() == QEvent::MouseButtonPress) {
+            suggest.hide();
+            setFocus();
+            return true;
+        } else if (obj == &suggest && e->type() == QEvent::KeyPress) {
+            auto sel = suggest.selectionModel();
+            auto idx = [&](int x){ return suggest.model()->index(sel->currentIndex().row()+x, 0); };
+            const auto keyEv = static_cast<QKeyEvent *>(e);
+            if (QKeySequence(keyEv->key() + keyEv->modifiers()) == SHORTCUT_NEXT)
+                sel->setCurrentIndex(idx(+1), QItemSelectionModel::ClearAndSelect);
+            else if (QKeySequence(keyEv->key() + keyEv->modifiers()) == SHORTCUT_PREV)
+                sel->setCurrentIndex(idx(-1), QItemSelectionModel::ClearAndSelect);
+            else
+                event(e);
+            return keyEv->key() != Qt::Key_Up && keyEv->key() != Qt::Key_Down;
+        } else if (e->type() == QEvent::InputMethod || e->type() == QEvent::InputMethodQuery) {
+            return event(e);
+        }
+        return false;
+    }
+
+    void showSuggestions() {
+        TortaTrace::Scope trace("bar", "showSuggestions");
+        suggest.move(mapToGlobal(QPoint(0, height())));
+        suggest.resize(width(), 5 + suggest.sizeHintForRow(0) * qMin(20, model.rowCount()));
+        suggest.show();
+    }
+
+public:
+    TortaBar(Torta * const torta) : QLineEdit(torta), model(this), suggest(this), parent(torta) {
+        suggest.setModel(&model);
+        suggest.setWindowFlags(Qt::Popup);
+        suggest.setFocusPolicy(Qt::NoFocus);
+        suggest.setFocusProxy(this);
+        suggest.installEventFilter(this);
+
+        connect(this, &QLineEdit::returnPressed, [this]{ suggest.hide(); });
+        connect(suggest.selectionModel(), &QItemSelectionModel::currentChanged,
+                [&](const QModelIndex &c, const QModelIndex &_){ setText(c.data().toString()); });
+        connect(this, &QLineEdit::textEdited, [this, torta](const QString &word){
+            TortaTrace::Scope trace("bar", "textEdited");
+            const int current = ++generation;
+            if (word.isEmpty())
+                return suggest.hide();
+
+            static QString before;
+            QString match = torta->db.firstForwardMatch(word);
+            const bool completed = !before.startsWith(word) && !match.isEmpty();
+            if (completed)
+                open(word, match.remove(0, word.length()));
+            before = word;
+            torta->speculate(completed ? text() : "");
+
+            QStringList list;
+            const QueryType type = guessQueryType(word);
+            if (type == SearchWithoutScheme)
+                list << "search:" + word << "http://" + word;
+            else if (type == URLWithoutScheme)
+                list << "http://" + word << "search:" + word;
+
+            if (word.startsWith("~/") || word.startsWith("/"))
+                list << "file://" + expandFilePath(word);
+
+            list << "find:" + word;
+            model.setRows(0, list);
+            suggest.selectionModel()->clear();
+            showSuggestions();
+
+            const int history = list.length();
+            torta->db.suggest(this, word.split(' ', QString::SkipEmptyParts),
+                              [this, current, history](int offset, const QStringList &rows){
+                TortaTrace::Scope trace("bar", "suggestionsReady");
+                if (current == generation) {
+                    model.setRows(history + offset, rows);
+                    showSuggestions();
+                }
+            });
+        });
+
+        if (torta->incognito)
+            setStyleSheet("background-color: dimgray; color: white;");
+
+        setVisible(false);
+    }
+
+    void open(const QString &prefix, const QString &content) {
+        setFixedWidth(parentWidget()->width() - 4);
+        setText(prefix + content);
+        setVisible(true);
+        setFocus(Qt::ShortcutFocusReason);
+        setSelection(prefix.length(), content.length());
+    }
+
+    void close() {
+        parent->speculate("");
+        parent->view.setFocus(Qt::ShortcutFocusReason);
+        suggest.hide();
+        setVisible(false);
+        setText("");
+    }
+};
+
+
+class TortaInterceptor : public QWebEngineUrlRequestInterceptor {
+    QMutex mutex;
+    QSet<QUrl> requested;
+    QSet<QUrl> loaded;
+    qint64 requests = 0;
+    qint64 repeats = 0;
+    qint64 loads[2] = {0, 0};
+    qint64 loadTimes[2] = {0, 0};
+    QAtomicInteger<qint64> blocked = 0;
+    QAtomicInteger<qint64> blockedThirdParty = 0;
+
+
+    static QAtomicPointer<const TortaFilter> &filter() {
+        static QAtomicPointer<const TortaFilter> compiled;
+        return compiled;
+    }
+
+    static int filterType(QWebEngineUrlRequestInfo::ResourceType type) {
+        using Info = QWebEngineUrlRequestInfo;
+        static const QHash<int, int> types{
+            {Info::ResourceTypeMainFrame, TortaFilter::Document},
+            {Info::ResourceTypeSubFrame, TortaFilter::Subdocument},
+            {Info::ResourceTypeStylesheet, TortaFilter::Stylesheet},
+            {Info::ResourceTypeScript, TortaFilter::Script},
+            {Info::ResourceTypeImage, TortaFilter::Image},
+            {Info::ResourceTypeFontResource, TortaFilter::Font},
+            {Info::ResourceTypeObject, TortaFilter::Object},
+            {Info::ResourceTypePluginResource, TortaFilter::Object},
+            {Info::ResourceTypeMedia, TortaFilter::Media},
+            {Info::ResourceTypeXhr, TortaFilter::XHR},
+            {Info::ResourceTypePing, TortaFilter::Ping},
+            {Info::ResourceTypeCspReport, TortaFilter::Ping},
+        };
+        return types.value(type, TortaFilter::Other);
+    }
+
+public:
+    TortaInterceptor(QObject *parent) : QWebEngineUrlRequestInterceptor(parent) {}
+
+    static void loadFilters(const QString &path) {
+        QThread *thread = QThread::create([path]{
+            QElapsedTimer timer;
+            timer.start();
+            const TortaFilter * const compiled = TortaFilter::fromDirectory(path);
+            qCInfo(tortaFilter) << compiled->rulesCount() << "rules from" << path
+                                << "compiled in" << timer.elapsed() << "ms";
+            filter().storeRelease(compiled);
+        });
+        QObject::connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+        thread->start(QThread::LowPriority);
+    }
+
+    void interceptRequest(QWebEngineUrlRequestInfo &info) override {
+        const TortaFilter * const compiled = filter().loadAcquire();
+        const int type = filterType(info.resourceType());
+        if (compiled && compiled->blocks(info.requestUrl(), info.firstPartyUrl(), type)) {
+            info.block(true);
+            blocked++;
+            if (TortaFilter::isThirdParty(info.requestUrl(), info.firstPartyUrl()))
+                blockedThirdParty++;
+            return;
+        }
+
+        if (info.requestMethod() != "GET")
+            return;
+
+        QMutexLocker locker(&mutex);
+        requests++;
+        if (requested.contains(info.requestUrl()))
+            repeats++;
+        else if (requested.size() < INTERCEPT_SEEN_LIMIT)
+            requested.insert(info.requestUrl());
+    }
+
+    void recordLoad(const QUrl &url, qint64 msecs) {
+        QMutexLocker locker(&mutex);
+        const bool repeat = loaded.contains(url);
+        loads[repeat]++;
+        loadTimes[repeat] += msecs;
+        if (!repeat && loaded.size() < INTERCEPT_SEEN_LIMIT)
+            loaded.insert(url);
+    }
+
+    QString report(const QWebEngineProfile *profile) {
+        qint64 size = 0;
+        QDirIterator it(profile->cachePath(), QDir::Files, QDirIterator::Subdirectories);
+        while (!profile->isOffTheRecord() && it.hasNext()) {
+            it.next();
+            size += it.fileInfo().size();
+        }
+
+        QMutexLocker locker(&mutex);
+        auto average = [this](bool r){ return loads[r] ? loadTimes[r] / loads[r] : 0; };
+        return QString("%1: cache %2 bytes on disk, %3 GET requests (%4 repeated, %5 first), "
+                       "page load %6 ms first / %7 ms repeated (%8 / %9 loads), "
+                       "%10 requests blocked (%11 third-party)")
+                   .arg(profile->isOffTheRecord() ? "incognito" : "default").arg(size)
+                   .arg(requests).arg(repeats).arg(requests - repeats)
+                   .arg(average(false)).arg(average(true)).arg(loads[0]).arg(loads[1])
+                   .arg(blocked.loadRelaxed()).arg(blockedThirdParty.loadRelaxed());
+    }
+};
+
+
+class TortaDownloader {
+    static void launch(const QByteArray &frame) {
+        auto input = new QTemporaryFile(qApp);
+        if (!input->open() || input->write(frame) != frame.size() || !input->flush()) {
+            qWarning() << "failed to write download request:" << input->errorString();
+            delete input;
+            return;
+        }
+
+        QProcess process;
+        process.setProgram("torta-dl");
+        process.setArguments({"--requests", "-"});
+        process.setStandardInputFile(input->fileName());
+        if (!process.startDetached())
+            qWarning() << "failed to start torta-dl";
+        QTimer::singleShot(DOWNLOAD_HANDOFF_TIMEOUT, input, &QObject::deleteLater);
+    }
+
+public:
+    static void track(QWebEngineProfile *profile) {
+        auto jar = new QNetworkCookieJar(profile);
+        QObject::connect(profile->cookieStore(), &QWebEngineCookieStore::cookieAdded, jar,
+                         [jar](const QNetworkCookie &cookie){ jar->insertCookie(cookie); });
+        QObject::connect(profile->cookieStore(), &QWebEngineCookieStore::cookieRemoved, jar,
+                         [jar](const QNetworkCookie &cookie){ jar->deleteCookie(cookie); });
+        profile->cookieStore()->loadAllCookies();
+    }
+
+    static void download(QWebEngineProfile *profile, const QUrl &url, const QUrl &referrer) {
+        TortaRequest request{url, QString(), referrer, {
+            {"User-Agent", profile->httpUserAgent().toLatin1()},
+            {"Accept-Language", profile->httpAcceptLanguage().toLatin1()},
+        }};
+        if (auto jar = profile->findChild<QNetworkCookieJar *>()) {
+            QList<QByteArray> cookies;
+            for (const QNetworkCookie &cookie: jar->cookiesForUrl(url))
+                cookies << cookie.toRawForm(QNetworkCookie::NameAndValueOnly);
+            if (!cookies.isEmpty())
+                request.headers << qMakePair(QByteArray("Cookie"), cookies.join("; "));
+        }
+
+        const QByteArray frame(TortaRequest::pack({request}));
+        auto sock = new QLocalSocket(qApp);
+        QObject::connect(sock, &QLocalSocket::connected, [sock, frame]{ sock->write(frame); });
+        QObject::connect(sock, &QLocalSocket::readyRead, [sock, url]{
+            QByteArray payload;
+            if (!TortaRequest::readFrame(sock, payload))
+                return;
+
+            QVector<bool> accepted;
+            if (!TortaRequest::unpackAck(payload, accepted) || accepted.size() != 1
+                    || !accepted.first())
+                qWarning() << "torta-dl rejected" << url.toString();
+            sock->disconnectFromServer();
+            sock->deleteLater();
+        });
+        QObject::connect(sock, &QLocalSocket::errorOccurred,
+                         [sock, frame](QLocalSocket::LocalSocketError error){
+            if (error == QLocalSocket::ServerNotFoundError
+                    || error == QLocalSocket::ConnectionRefusedError)
+                launch(frame);
+            sock->deleteLater();
+        });
+        QTimer::singleShot(DOWNLOAD_ACK_TIMEOUT, sock, [sock, url]{
+            qWarning() << "no response from torta-dl for" << url.toString();
+            sock->abort();
+            sock->deleteLater();
+        });
+        sock->connectToServer(DOWNLOADER_CONNECTION_NAME);
+    }
+};
+
+
+class TortaProfiles {
+    struct Options {
+        QWebEngineProfile::HttpCacheType cacheType = QWebEngineProfile::DiskHttpCache;
+        int cacheSize = 0;
+        QString cachePath;
+        QWebEngineProfile::PersistentCookiesPolicy cookies =
+            QWebEngineProfile::AllowPersistentCookies;
+    };
+
+
+    static Options &options() {
+        static Options o;
+        return o;
+    }
+
+    static QWebEngineProfile *&created(bool incognito) {
+        static QWebEngineProfile *profiles[2] = {nullptr, nullptr};
+        return profiles[incognito];
+    }
+
+    static QWebEngineScript navigationScript() {
+        QWebEngineScript script;
+        script.setName("torta");
+        script.setWorldId(QWebEngineScript::ApplicationWorld);
+        script.setInjectionPoint(QWebEngineScript::DocumentCreation);
+        script.setRunsOnSubFrames(false);
+        script.setSourceCode(R"(
+            (function(){
+                var x = 0, y = 0, frame = 0;
+                window.torta = {
+                    scroll: function(dx, dy) {
+                        x += dx;
+                        y += dy;
+                        frame = frame || requestAnimationFrame(function(){
+                            window.scrollBy(x, y);
+                            x = y = frame = 0;
+                        });
+                    },
+                    page: function(n) { torta.scroll(0, n * window.innerHeight / 2); },
+                    top: function() { window.scrollTo(0, 0); },
+                    bottom: function() { window.scrollTo(0, document.body.scrollHeight); },
+                    exitFullscreen: function() { document.webkitExitFullscreen(); }
+                };
+            })();
+        )");
+        return script;
+    }
+
+    static QWebEngineProfile *setup(QWebEngineProfile *profile) {
+        QObject::connect(profile, &QWebEngineProfile::downloadRequested,
+                         [profile](QWebEngineDownloadItem *d){
+            TortaDownloader::download(profile, d->url(),
+                                      d->page() != nullptr ? d->page()->url() : QUrl());
+            d->cancel();
+        });
+        TortaDownloader::track(profile);
+        profile->setHttpUserAgent(USER_AGENT);
+        profile->setHttpAcceptLanguage(QLocale().bcp47Name());
+        profile->scripts()->insert(navigationScript());
+        // setUrlRequestInterceptor runs interceptRequest on the UI thread since Qt 5.13. The
+        // deprecated call keeps filter matching on the IO thread, which the atomic filter pointer
+        // and the locked counters of TortaInterceptor are made for.
+QT_WARNING_PUSH
+QT_WARNING_DISABLE_DEPRECATED
+        profile->setRequestInterceptor(new TortaInterceptor(profile));
+QT_WARNING_POP
+
+        if (!profile->isOffTheRecord()) {
+            profile->setHttpCacheType(options().cacheType);
+            profile->setHttpCacheMaximumSize(options().cacheSize);
+            if (!options().cachePath.isEmpty())
+                profile->setCachePath(options().cachePath);
+            profile->setPersistentCookiesPolicy(options().cookies);
+        }
+        return profile;
+    }
+
+public:
+    static bool configure(const QCommandLineParser &parser) {
+        const QString cache(parser.value("cache"));
+        const QString cookies(parser.value("cookies"));
+        bool ok;
+        const qint64 cacheSize = parser.value("cache-size").toLongLong(&ok);
+        if (!QStringList({"disk", "memory", "none"}).contains(cache)) {
+            qCritical().noquote() << "invalid cache type:" << cache;
+            return false;
+        } else if (!ok || cacheSize < 0) {
+            qCritical().noquote() << "invalid cache size:" << parser.value("cache-size");
+            return false;
+        } else if (!QStringList({"allow", "session", "force"}).contains(cookies)) {
+            qCritical().noquote() << "invalid cookie policy:" << cookies;
+            return false;
+        }
+
+        options().cacheType = cache == "memory" ? QWebEngineProfile::MemoryHttpCache
+                            : cache == "none"   ? QWebEngineProfile::NoCache
+                                                : QWebEngineProfile::DiskHttpCache;
+        options().cacheSize = int(qMin(qMin(cacheSize, qint64(INT_MAX)) * 1024 * 1024,
+                                       qint64(INT_MAX)));
+        if (parser.isSet("cache-path"))
+            options().cachePath = expandFilePath(parser.value("cache-path"));
+
+        options().cookies = cookies == "session" ? QWebEngineProfile::NoPersistentCookies
+                          : cookies == "force"   ? QWebEngineProfile::ForcePersistentCookies
+                                                 : QWebEngineProfile::AllowPersistentCookies;
+
+        if (!parser.isSet("no-filters")) {
+            TortaInterceptor::loadFilters(
+                QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/filters");
+        }
+        return true;
+    }
+
+    static TortaInterceptor *interceptor(bool incognito) {
+        return profile(incognito)->findChild<TortaInterceptor *>();
+    }
+
+    static QString statistics() {
+        QStringList r;
+        for (bool incognito: {false, true}) {
+            if (created(incognito) != nullptr)
+                r << interceptor(incognito)->report(created(incognito));
+        }
+        return r.join("\n");
+    }
+
+    // Deleting the profiles writes out their cookies, so this has to run while QApplication is
+    // still alive, and after every page using them is gone.
+    static void release() {
+        for (bool incognito: {false, true}) {
+            delete created(incognito);
+            created(incognito) = nullptr;
+        }
+    }
+
+    static QWebEngineProfile *profile(bool incognito) {
+        QWebEngineProfile *&p = created(incognito);
+        if (p == nullptr)
+            p = setup(incognito ? new QWebEngineProfile : new QWebEngineProfile("Default"));
+        return p;
+    }
+};
+
+
+class TortaPage : public QWebEnginePage {
+Q_OBJECT
+
+    const TortaDatabase &db;
+    const bool incognito;
+
+
+    bool certificateError(const QWebEngineCertificateError &_) override {
+        emit sslError();
+        return true;
+    }
+
+    bool acceptNavigationRequest(const QUrl &url, NavigationType type, bool isMainFrame) override {
+        if (isMainFrame)
+            db.site(url.host(), incognito).apply(this, url.host() != this->url().host());
+        return QWebEnginePage::acceptNavigationRequest(url, type, isMainFrame);
+    }
+
+public:
+    TortaPage(const TortaDatabase &db, bool incognito, QObject *parent)
+            : QWebEnginePage(TortaProfiles::profile(incognito), parent),
+              db(db), incognito(incognito) {
+        settings()->setAttribute(QWebEngineSettings::FullScreenSupportEnabled, true);
+    }
+
+    void triggerAction(WebAction wa, bool checked=false) override {
+        if (wa == QWebEnginePage::DownloadImageToDisk || wa == QWebEnginePage::DownloadMediaToDisk)
+            TortaDownloader::download(profile(), contextMenuData().mediaUrl(), url());
+        else if (wa == QWebEnginePage::DownloadLinkToDisk)
+            TortaDownloader::download(profile(), contextMenuData().linkUrl(), url());
+        else
+            QWebEnginePage::triggerAction(wa, checked);
+    }
+
+signals:
+    void sslError();
+};
+
+
+template <class Torta> class TortaView : public QWebEngineView {
+    Torta * const parent;
+
+
+    QWebEngineView * createWindow(QWebEnginePage::WebWindowType type) override {
+        Torta * const window = new Torta(parent->db, parent->incognito);
+        if (type == QWebEnginePage::WebBrowserBackgroundTab)
+            parentWidget()->activateWindow();
+        return &window->view;
+    }
+
+public:
+    TortaView(Torta * const torta) : QWebEngineView(torta), parent(torta) {}
+};
+
+
+template <class Torta> class TortaLifecycle : public QObject {
+    const qint64 freezeAfter;
+    const qint64 discardAfter;
+    const qint64 memoryLimit;
+    QTimer timer;
+
+
+    void check() {
+        QVector<Torta *> windows;
+        for (QWidget *w: QApplication::topLevelWidgets()) {
+            auto torta = dynamic_cast<Torta *>(w);
+            if (torta && torta->attached)
+                windows << torta;
+        }
+        std::sort(windows.begin(), windows.end(), [](const Torta *a, const Torta *b){
+            return a->idle() > b->idle();
+        });
+
+        QSet<qint64> pids;
+        QHash<Torta *, qint64> resident;
+        qint64 total = residentKB(QCoreApplication::applicationPid());
+        for (Torta *torta: windows) {
+            const qint64 pid = torta->view.page()->renderProcessPid();
+            resident[torta] = pids.contains(pid) ? 0 : residentKB(pid);
+            total += resident[torta];
+            pids << pid;
+            qCInfo(tortaMemory) << torta->view.url().toString() << "pid" << pid
+                                << resident[torta] << "kB, idle" << torta->idle() / 1000 << "s,"
+                                << torta->view.page()->lifecycleState();
+        }
+        qCInfo(tortaMemory) << "total" << total << "kB in" << windows.length() << "windows";
+
+        for (Torta *torta: windows) {
+            if (!torta->dormant())
+                continue;
+
+            const auto state = torta->view.page()->lifecycleState();
+            if (torta->idle() >= discardAfter || (memoryLimit > 0 && total > memoryLimit)) {
+                if (state != QWebEnginePage::LifecycleState::Discarded) {
+                    total -= resident[torta];
+                    torta->sleep(QWebEnginePage::LifecycleState::Discarded);
+                }
+            } else if (torta->idle() >= freezeAfter
+                       && state == QWebEnginePage::LifecycleState::Active) {
+                torta->sleep(QWebEnginePage::LifecycleState::Frozen);
+            }
+        }
+    }
+
+public:
+    TortaLifecycle(int freezeAfter, int discardAfter, int memoryLimit)
+            : freezeAfter(freezeAfter * 1000LL), discardAfter(discardAfter * 1000LL),
+              memoryLimit(memoryLimit * 1024LL) {
+        connect(&timer, &QTimer::timeout, this, &TortaLifecycle::check);
+        timer.start(LIFECYCLE_INTERVAL);
+    }
+};
+
+
+template <class Torta> class TortaSession : public QObject {
+    TortaDatabase &db;
+    QTimer timer;
+
+
+    static QString path() {
+        return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/session";
+    }
+
+    static TortaSession *&current() {
+        static TortaSession *session = nullptr;
+        return session;
+    }
+
+    QVector<Torta *> windows() {
+        QVector<Torta *> windows;
+        for (QWidget *w: QApplication::topLevelWidgets()) {
+            auto torta = dynamic_cast<Torta *>(w);
+            if (torta && !torta->incognito && torta->isVisible())
+                windows << torta;
+        }
+        return windows;
+    }
+
+    bool eventFilter(QObject *obj, QEvent *e) override {
+        if (e->type() == QEvent::Close) {
+            const QVector<Torta *> open(windows());
+            if (open.length() == 1 && open.first() == obj)
+                write(open);
+            else
+                QTimer::singleShot(0, this, &TortaSession::save);
+        }
+        return false;
+    }
+
+    void save() {
+        const QVector<Torta *> open(windows());
+        if (!open.isEmpty())
+            write(open);
+    }
+
+    void write(const QVector<Torta *> &windows) {
+        QSaveFile file(path());
+        if (!file.open(QIODevice::WriteOnly))
+            return;
+
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_15);
+        stream << quint32(SESSION_VERSION) << windows.length();
+        for (const Torta *torta: windows) {
+            if (!torta->attached) {
+                stream << torta->suspendedUrl << torta->windowTitle() << torta->suspendedZoom
+                       << torta->suspended;
+                continue;
+            }
+            QByteArray history;
+            QDataStream serializer(&history, QIODevice::WriteOnly);
+            serializer << *torta->view.history();
+            stream << torta->view.url() << torta->windowTitle() << torta->view.zoomFactor()
+                   << history;
+        }
+        file.commit();
+    }
+
+public:
+    TortaSession(TortaDatabase &db) : db(db) {
+        current() = this;
+        connect(&timer, &QTimer::timeout, this, &TortaSession::save);
+        connect(qApp, &QCoreApplication::aboutToQuit, this, &TortaSession::save);
+        timer.start(SESSION_SAVE_INTERVAL);
+    }
+
+    ~TortaSession() {
+        current() = nullptr;
+    }
+
+    static void track(Torta *torta) {
+        if (current() != nullptr && !torta->incognito)
+            torta->installEventFilter(current());
+    }
+
+    bool restore() {
+        QFile file(path());
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_15);
+        quint32 version;
+        int count;
+        stream >> version >> count;
+        if (version != SESSION_VERSION)
+            return false;
+
+        int restored = 0;
+        for (; restored < count; restored++) {
+            QUrl url;
+            QString title;
+            qreal zoom;
+            QByteArray history;
+            stream >> url >> title >> zoom >> history;
+            if (stream.status() != QDataStream::Ok)
+                break;
+            (new Torta(db, false, true))->suspend(url, title, zoom, history);
+        }
+        return restored > 0;
+    }
+};
+
+
+class DobosTorta : public QMainWindow {
+    friend class TortaBar<DobosTorta>;
+    friend class TortaView<DobosTorta>;
+    friend class TortaLifecycle<DobosTorta>;
+    friend class TortaSession<DobosTorta>;
+
+    const bool incognito;
+    TortaBar<DobosTorta> bar;
+    TortaView<DobosTorta> view;
+    TortaDatabase &db;
+    QVector<QPair<const QKeySequence, const std::function<void(void)>>> shortcuts;
+    QTimer scrollTimer;
+    QPoint scrollDelta;
+    QElapsedTimer loadTimer;
+    QElapsedTimer inactive;
+    TortaPage *prerender = nullptr;
+    QUrl prerenderUrl;
+    QTimer prerenderDelay;
+    QElapsedTimer prerenderTimer;
+    qint64 prerenderLoadTime = -1;
+    bool attached = false;
+    QUrl suspendedUrl;
+    qreal suspendedZoom = 1.0;
+    QByteArray suspended;
+
+
+    void keyPressEvent(QKeyEvent *e) override {
+        if (!executeShortcuts(e))
+            QMainWindow::keyPressEvent(e);
+    }
+
+    void changeEvent(QEvent *e) override {
+        if (e->type() == QEvent::ActivationChange && isActiveWindow()) {
+            resume();
+            wake();
+        } else if (e->type() == QEvent::ActivationChange)
+            inactive.start();
+        QMainWindow::changeEvent(e);
+    }
+
+    bool eventFilter(QObject *obj, QEvent *e) override {
+        if (obj == windowHandle()) {
+            if (e->type() == QEvent::Expose && windowHandle()->isExposed())
+                wake();
+            return false;
+        }
+        return e->type() == QEvent::KeyPress && executeShortcuts(static_cast<QKeyEvent*>(e));
+    }
+
+    qint64 idle() const {
+        return inactive.isValid() && !isActiveWindow() ? inactive.elapsed() : 0;
+    }
+
+    bool dormant() const {
+        return !isActiveWindow() && (isMinimized() || !windowHandle()->isExposed());
+    }
+
+    void sleep(QWebEnginePage::LifecycleState state) {
+        view.page()->setVisible(false);
+        view.page()->setLifecycleState(state);
+    }
+
+    void wake() {
+        if (!attached)
+            return;
+        if (view.page()->lifecycleState() != QWebEnginePage::LifecycleState::Active)
+            view.page()->setLifecycleState(QWebEnginePage::LifecycleState::Active);
+        view.page()->setVisible(true);
+    }
+
+    // Restored windows stay without a page, and so without any WebEngine state, until they are
+    // first activated. The view is kept hidden meanwhile, because showing a QWebEngineView makes
+    // it create a default page on the default profile.
+    void suspend(const QUrl &url, const QString &title, qreal zoom, const QByteArray &history) {
+        setWindowTitle(title.isEmpty() ? url.toString() : title);
+        suspendedUrl = url;
+        suspendedZoom = zoom;
+        suspended = history;
+        updateFrameColor();
+    }
+
+    void resume() {
+        if (attached)
+            return;
+
+        attach();
+        view.setZoomFactor(suspendedZoom);
+        QDataStream stream(suspended);
+        stream >> *view.history();
+        if (view.history()->count() == 0)
+            view.load(suspendedUrl);
+        suspended.clear();
+    }
+
+    void setupShortcuts() {
+        shortcuts.append({SHORTCUT_FORWARD,          [this]{ view.forward(); }});
+        shortcuts.append({{Qt::ALT + Qt::Key_Right}, [this]{ view.forward(); }});
+        shortcuts.append({SHORTCUT_BACK,             [this]{ view.back();    }});
+        shortcuts.append({{Qt::ALT + Qt::Key_Left},  [this]{ view.back();    }});
+        shortcuts.append({SHORTCUT_RELOAD,           [this]{ view.reload();  }});
+
+        auto toggleBar = [this]{
+            if (guessQueryType(bar.text()) == InSiteSearch)
+                bar.open("", bar.text().remove(0, 5));
+            else if (!bar.isVisible())
+                bar.open("", view.url().toDisplayString());
+            else
+                bar.close();
+        };
+        shortcuts.append({SHORTCUT_BAR,     toggleBar});
+        shortcuts.append({SHORTCUT_BAR_ALT, toggleBar});
+        shortcuts.append({SHORTCUT_FIND,    [this]{
+            if (!bar.isVisible() || guessQueryType(bar.text()) != InSiteSearch)
+                bar.open("find:", bar.text());
+            else
+                bar.close();
+        }});
+
+        auto js = [&](const QString &s){
+            return [this, s]{ view.page()->runJavaScript(s, QWebEngineScript::ApplicationWorld); };
+        };
+        auto sc = [&](int x, int y){ return [this, x, y]{ scroll(x, y); }; };
+
+        scrollTimer.setSingleShot(true);
+        scrollTimer.setInterval(SCROLL_INTERVAL);
+        connect(&scrollTimer, &QTimer::timeout, [this]{
+            view.page()->runJavaScript(QString("torta.scroll(%1, %2)").arg(scrollDelta.x())
+                                                                      .arg(scrollDelta.y()),
+                                       QWebEngineScript::ApplicationWorld);
+            scrollDelta = QPoint();
+        });
+
+        shortcuts.append({SHORTCUT_DOWN,  sc(0, 40)});
+        shortcuts.append({SHORTCUT_UP,    sc(0, -40)});
+        shortcuts.append({SHORTCUT_RIGHT, sc(40, 0)});
+        shortcuts.append({SHORTCUT_LEFT,  sc(-40, 0)});
+        shortcuts.append({{Qt::Key_PageDown}, js("torta.page(1)")});
+        shortcuts.append({{Qt::Key_PageUp},   js("torta.page(-1)")});
+        shortcuts.append({SHORTCUT_TOP,    js("torta.top()")});
+        shortcuts.append({{Qt::Key_Home},  js("torta.top()")});
+        shortcuts.append({SHORTCUT_BOTTOM, js("torta.bottom()")});
+        shortcuts.append({{Qt::Key_End},   js("torta.bottom()")});
+
+        auto f = [&](QWebEnginePage::FindFlags f){ return [&, f]{ inSiteSearch(bar.text(), f); }; };
+        shortcuts.append({SHORTCUT_NEXT, f(QWebEnginePage::FindFlags())});
+        shortcuts.append({SHORTCUT_PREV, f(QWebEnginePage::FindBackward)});
+
+        auto zoom = [&](float x){ return [this, x]{ view.setZoomFactor(view.zoomFactor() + x); }; };
+        shortcuts.append({SHORTCUT_ZOOMIN,     zoom(+0.1)});
+        shortcuts.append({SHORTCUT_ZOOMIN_ALT, zoom(+0.1)});
+        shortcuts.append({SHORTCUT_ZOOMOUT,    zoom(-0.1)});
+        shortcuts.append({SHORTCUT_ZOOMRESET,  [this]{ view.setZoomFactor(1.0); }});
+        shortcuts.append({SHORTCUT_ZOOMSAVE,   [this]{
+            TortaSite site(db.site(view.url().host(), incognito));
+            site.zoom = view.zoomFactor();
+            db.setSite(view.url().host(), site, incognito);
+        }});
+
+        shortcuts.append({SHORTCUT_LIGHT, [this]{
+            const QString host(view.url().host());
+            const TortaSite site(db.site(host, incognito));
+            const TortaSite toggled(site.javascript ? TortaSite::light(site.zoom)
+                                                    : TortaSite{true, true, true, true, site.zoom});
+            db.setSite(host, toggled, incognito);
+            toggled.apply(view.page());
+            view.reload();
+        }});
+
+        shortcuts.append({SHORTCUT_NEW_WINDOW, [this]{ (new DobosTorta(db))->load(HOMEPAGE); }});
+        shortcuts.append({SHORTCUT_INCOGNITO, [this]{(new DobosTorta(db, true))->load(HOMEPAGE);}});
+
+        shortcuts.append({SHORTCUT_ESCAPE,  js("torta.exitFullscreen()")});
+        shortcuts.append({{Qt::Key_Escape}, js("torta.exitFullscreen()")});
+    }
+
+    void scroll(int x, int y) {
+        scrollDelta += QPoint(x, y);
+        if (!scrollTimer.isActive())
+            scrollTimer.start();
+    }
+
+    void setupBar() {
+        connect(&bar, &QLineEdit::textChanged, [this]{ inSiteSearch(bar.text()); });
+        connect(&bar, &QLineEdit::returnPressed, [this]{
+            if (!adoptPrerender(bar.text()))
+                load(bar.text());
+            if (guessQueryType(bar.text()) != InSiteSearch)
+                bar.close();
+        });
+        setMenuWidget(&bar);
+    }
+
+    void setupView() {
+        connect(&view, &QWebEngineView::titleChanged,
+            [&](const QString &title){ setWindowTitle((incognito ? "incognito: " : "") + title); });
+        connect(&view, &QWebEngineView::urlChanged, [this](const QUrl &url){ visit(url); });
+        connect(&view, &QWebEngineView::loadStarted, [this]{
+            TortaTrace::instant("navigation", "loadStarted", view.url().toString());
+            loadTimer.start();
+        });
+        connect(&view, &QWebEngineView::loadFinished, [this](bool ok){
+            if (loadTimer.isValid())
+                TortaTrace::complete("navigation", ok ? "load" : "loadFailed",
+                                     loadTimer.nsecsElapsed(), view.url().toString());
+            if (ok && loadTimer.isValid())
+                TortaProfiles::interceptor(incognito)->recordLoad(view.url(), loadTimer.elapsed());
+            loadTimer.invalidate();
+        });
+    }
+
+    void visit(const QUrl &url) {
+        TortaTrace::instant("navigation", "urlChanged", url.toString());
+        updateFrameColor();
+        if (!incognito)
+            db.append(url.scheme(), url.url().remove(0, url.scheme().length() + 1));
+    }
+
+    void attach() {
+        auto page = new TortaPage(db, incognito, &view);
+        view.setPage(page);
+        setupPage(page);
+        setCentralWidget(&view);
+        view.show();
+        attached = true;
+    }
+
+    void setupPage(TortaPage * const page) {
+        connect(page, &QWebEnginePage::linkHovered, [this](const QUrl &url){
+            setWindowTitle((incognito ? "incognito: " : "")
+                           + (url.isEmpty() ? view.title() : url.toDisplayString()));
+        });
+        connect(page, &QWebEnginePage::iconChanged, this, &QWidget::setWindowIcon);
+        connect(page, &QWebEnginePage::fullScreenRequested, [this](QWebEngineFullScreenRequest r){
+            if (r.toggleOn())
+                showFullScreen();
+            else
+                showNormal();
+
+            if (isFullScreen() == r.toggleOn())
+                r.accept();
+            else
+                r.reject();
+        });
+        connect(page, &TortaPage::sslError, [this]{ updateFrameColor(true); });
+    }
+
+    QUrl target(const QString &query) {
+        const QueryType type(guessQueryType(query));
+        if (type == URLWithScheme)
+            return QUrl(query);
+        else if (type == URLWithoutScheme)
+            return QUrl(db.expandAbridgedAddress(query));
+        return QUrl();
+    }
+
+    void speculate(const QString &query) {
+        const QUrl url(incognito || query.isEmpty() ? QUrl() : target(query));
+        if (url == prerenderUrl)
+            return;
+
+        cancelPrerender();
+        if (url.scheme() != "http" && url.scheme() != "https")
+            return;
+
+        prerenderUrl = url;
+        prerenderDelay.start();
+    }
+
+    void startPrerender() {
+        static QPointer<DobosTorta> owner;
+        if (owner && owner != this)
+            owner->cancelPrerender();
+        owner = this;
+
+        prerender = new TortaPage(db, incognito, this);
+        connect(prerender, &QWebEnginePage::loadFinished, [this](bool ok){
+            if (ok && prerenderLoadTime < 0)
+                prerenderLoadTime = prerenderTimer.elapsed();
+        });
+        prerenderLoadTime = -1;
+        prerenderTimer.start();
+        prerender->load(prerenderUrl);
+    }
+
+    void cancelPrerender() {
+        prerenderDelay.stop();
+        if (prerender != nullptr) {
+            recordPrerender(false, 0);
+            prerender->deleteLater();
+            prerender = nullptr;
+        }
+        prerenderUrl = QUrl();
+    }
+
+    // The prerendered page has its own history, so it is only swapped in while the window has no
+    // history to lose. Otherwise it is left to be cancelled after the real load has started, so
+    // the connection and the cache it warmed up are still used.
+    bool adoptPrerender(const QString &query) {
+        if (prerender == nullptr || target(query) != prerenderUrl) {
+            cancelPrerender();
+            return false;
+        } else if (view.history()->count() > 0) {
+            return false;
+        }
+
+        recordPrerender(true, prerenderLoadTime < 0 ? prerenderTimer.elapsed() : prerenderLoadTime);
+
+        QWebEnginePage * const old = view.page();
+        prerender->setParent(&view);
+        setupPage(prerender);
+        {
+            const QSignalBlocker blocker(&view);
+            view.setPage(prerender);
+        }
+        old->deleteLater();
+        setWindowTitle((incognito ? "incognito: " : "") + view.title());
+        visit(view.url());
+
+        prerender = nullptr;
+        prerenderUrl = QUrl();
+        return true;
+    }
+
+    static void recordPrerender(bool hit, qint64 saved) {
+        static qint64 hits = 0, misses = 0, total = 0;
+        (hit ? hits : misses)++;
+        total += saved;
+        qCInfo(tortaPrerender) << (hit ? "hit," : "miss,") << "saved" << saved << "ms;"
+                               << hits << "hits" << misses << "misses" << total << "ms saved";
+    }
+
+    void webSearch(const QString &queryString) {
+        if (!incognito)
+            db.append("search", queryString);
+
+        QUrl url("https://google.com/search");
+        QUrlQuery query;
+        query.addQueryItem("q", queryString);
+        url.setQuery(query);
+
+        view.load(url);
+    }
+
+    void inSiteSearch(const QString &q, QWebEnginePage::FindFlags f={}) {
+        view.findText((!q.isEmpty() && guessQueryType(q) == InSiteSearch) ? q.mid(5) : "", f);
+    }
+
+    void updateFrameColor(bool error=false) {
+        if ((attached ? view.url() : suspendedUrl).scheme() != "https")
+            setStyleSheet(!incognito ? "QMainWindow { background-color: dimgray; }"
+                                     : "QMainWindow { background-color: blue; }");
+        else
+            setStyleSheet(QString(!incognito ? "QMainWindow{ background-color: %1 }"
+                : "QMainWindow {background: qlineargradient(x1:0, y1:0, x2:1, y2:1,  \
+                   stop:0 %1,stop:0.3 blue,stop:0.7 blue,stop:1 %1)}").arg(error ? "red" : "lime"));
+    }
+
+public:
+    DobosTorta(TortaDatabase &db, bool incognito=false, bool deferred=false)
+            : incognito(incognito), bar(this), view(this), db(db) {
+        setupBar();
+        setupView();
+        if (!deferred) {
+            attach();
+        } else {
+            view.hide();
+            setCentralWidget(new QWidget);
+        }
+        setupShortcuts();
+        installEventFilter(this);
+        TortaSession<DobosTorta>::track(this);
+
+        prerenderDelay.setSingleShot(true);
+        prerenderDelay.setInterval(PRERENDER_DELAY);
+        connect(&prerenderDelay, &QTimer::timeout, this, &DobosTorta::startPrerender);
+
+        setContentsMargins(2, 2, 2, 2);
+        updateFrameColor();
+
+        show();
+        windowHandle()->installEventFilter(this);
+    }
+
+    void load(const QString &query) {
+        const QueryType type(guessQueryType(query));
+        if (type == URLWithScheme)
+            view.load(query);
+        else if (type == URLWithoutScheme)
+            view.load(db.expandAbridgedAddress(query));
+        else if (type == SearchWithScheme)
+            webSearch(query.mid(7));
+        else if (type == SearchWithoutScheme)
+            webSearch(query);
+        else if (type == InSiteSearch)
+            inSiteSearch(query);
+    }
+
+    bool executeShortcuts(const QKeyEvent *e) {
+        TortaTrace::Scope trace("input", "executeShortcuts");
+        static QKeySequence key;
+        const QKeySequence seq(key[0], e->key() + e->modifiers());
+        key = QKeySequence(e->key() + e->modifiers());
+        for (const auto &sc: shortcuts) {
+            if (sc.first == key || sc.first == seq) {
+                sc.second();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+
+#endif
@@ -1,11 +1,12 @@
 TEMPLATE = app
 TARGET = dobostorta
-INCLUDEPATH += .
+INCLUDEPATH += . ../torta-dl
 INSTALLS += target
 target.path = /usr/local/bin
 
 DEFINES += GIT_VERSION=\\\"$$system(git describe --always --tags --dirty)\\\"
 
-QT += widgets webengine webenginewidgets sql
+QT += widgets webengine webenginewidgets sql network
 
+HEADERS += dobostorta.h filter.h ../torta-dl/request.h
 SOURCES += main.cpp
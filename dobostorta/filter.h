@@ -0,0 +1,342 @@
+#ifndef TORTA_FILTER_H
+#define TORTA_FILTER_H
+
+#include <algorithm>
+
+#include <QtCore>
+
+
+class TortaFilter {
+public:
+    enum Type {
+        Document    = 1 << 0,
+        Subdocument = 1 << 1,
+        Stylesheet  = 1 << 2,
+        Script      = 1 << 3,
+        Image       = 1 << 4,
+        Font        = 1 << 5,
+        Object      = 1 << 6,
+        Media       = 1 << 7,
+        XHR         = 1 << 8,
+        Ping        = 1 << 9,
+        Other       = 1 << 10,
+        AnyType     = (1 << 11) - 1
+    };
+
+private:
+    enum Party {
+        AnyParty,
+        ThirdParty,
+        FirstParty
+    };
+
+    struct Rule {
+        QList<QByteArray> parts;
+        bool hostAnchor;
+        bool startAnchor;
+        bool endAnchor;
+        int types;
+        Party party;
+    };
+
+    struct Index {
+        QHash<quint32, QVector<int>> tokens;
+        QVector<int> rest;
+    };
+
+    QSet<QByteArray> domains;
+    QVector<Rule> rules;
+    Index block;
+    Index allow;
+    int count = 0;
+
+
+    static bool isTokenChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '%';
+    }
+
+    static bool isSeparator(char c) {
+        return !(isTokenChar(c) || (c >= 'A' && c <= 'Z') || c == '_' || c == '-' || c == '.');
+    }
+
+    static quint32 hash(const char *str, int length) {
+        quint32 h = 2166136261u;
+        for (int i=0; i < length; i++)
+            h = (h ^ static_cast<quint8>(str[i])) * 16777619u;
+        return h;
+    }
+
+    static int typeOf(const QByteArray &name) {
+        static const QHash<QByteArray, int> types{
+            {"document", Document}, {"subdocument", Subdocument}, {"stylesheet", Stylesheet},
+            {"script", Script}, {"image", Image}, {"font", Font}, {"object", Object},
+            {"media", Media}, {"xmlhttprequest", XHR}, {"ping", Ping}, {"other", Other},
+        };
+        return types.value(name, 0);
+    }
+
+    static bool parseOptions(const QByteArray &options, int &types, Party &party) {
+        int include = 0, exclude = 0;
+        for (const QByteArray &option: options.split(',')) {
+            const bool negate = option.startsWith('~');
+            const QByteArray name(negate ? option.mid(1) : option);
+            if (name == "third-party" || name == "3p") {
+                party = negate ? FirstParty : ThirdParty;
+            } else if (name == "first-party" || name == "1p") {
+                party = negate ? ThirdParty : FirstParty;
+            } else if (typeOf(name) != 0) {
+                (negate ? exclude : include) |= typeOf(name);
+            } else {
+                return false;
+            }
+        }
+        types = (include != 0 ? include : types) & ~exclude;
+        return true;
+    }
+
+    static bool isDomain(const QByteArray &pattern) {
+        if (!pattern.endsWith('^') || pattern.length() < 2)
+            return false;
+        for (int i=0; i < pattern.length() - 1; i++) {
+            if (!isTokenChar(pattern[i]) && pattern[i] != '.' && pattern[i] != '-')
+                return false;
+        }
+        return true;
+    }
+
+    static QByteArray bestToken(const QByteArray &pattern, const Rule &rule) {
+        static const QSet<QByteArray> common{"http", "https", "www", "com"};
+        QByteArray best;
+        for (int begin=0; begin < pattern.length(); ) {
+            int end = begin;
+            while (end < pattern.length() && isTokenChar(pattern[end]))
+                end++;
+
+            const bool head = begin > 0 ? pattern[begin - 1] != '*'
+                                        : rule.hostAnchor || rule.startAnchor;
+            const bool tail = end < pattern.length() ? pattern[end] != '*' : rule.endAnchor;
+            const QByteArray token(pattern.mid(begin, end - begin));
+            if (head && tail && token.length() > best.length() && !common.contains(token))
+                best = token;
+
+            begin = end + 1;
+        }
+        return best;
+    }
+
+    static int matchHere(const char *url, int length, int at, const QByteArray &part) {
+        for (int i=0; i < part.length(); i++) {
+            if (at + i >= length)
+                return part[i] == '^' && i == part.length() - 1 ? length : -1;
+            if (part[i] == '^' ? !isSeparator(url[at + i]) : part[i] != url[at + i])
+                return -1;
+        }
+        return at + part.length();
+    }
+
+    static bool matches(const Rule &rule, const char *url, int length, int host, int hostEnd) {
+        int pos = 0;
+        for (int i=0; i < rule.parts.length(); i++) {
+            const QByteArray &part = rule.parts[i];
+            int end = -1;
+            if (i == 0 && rule.startAnchor) {
+                end = matchHere(url, length, 0, part);
+            } else if (i == 0 && rule.hostAnchor) {
+                for (int at=host; at < hostEnd && end < 0; at++) {
+                    if (at == host || url[at - 1] == '.')
+                        end = matchHere(url, length, at, part);
+                }
+            } else if (i == rule.parts.length() - 1 && rule.endAnchor) {
+                for (int at=qMax(pos, length - part.length()); at <= length && end != length; at++)
+                    end = matchHere(url, length, at, part);
+            } else {
+                for (int at=pos; at < length && end < 0; at++)
+                    end = matchHere(url, length, at, part);
+            }
+
+            if (end < 0)
+                return false;
+            pos = end;
+        }
+        return !rule.endAnchor || pos == length;
+    }
+
+    bool search(const Index &index, const char *url, int length, int host, int hostEnd,
+                int type, bool third) const {
+        auto test = [&](int id){
+            const Rule &rule = rules[id];
+            return (rule.types & type) != 0
+                   && (rule.party == AnyParty || (rule.party == ThirdParty) == third)
+                   && matches(rule, url, length, host, hostEnd);
+        };
+
+        for (int begin=0; begin < length; ) {
+            int end = begin;
+            while (end < length && isTokenChar(url[end]))
+                end++;
+
+            if (end > begin) {
+                const auto it = index.tokens.constFind(hash(url + begin, end - begin));
+                if (it != index.tokens.constEnd() && std::any_of(it->begin(), it->end(), test))
+                    return true;
+            }
+            begin = end + 1;
+        }
+        return std::any_of(index.rest.begin(), index.rest.end(), test);
+    }
+
+    static QSet<QByteArray> loadPublicSuffixes() {
+        QFile file(QStandardPaths::locate(QStandardPaths::GenericDataLocation,
+                                          "publicsuffix/public_suffix_list.dat"));
+        if (!file.open(QIODevice::ReadOnly)) {
+            return {"co.uk", "org.uk", "ac.uk", "gov.uk", "com.au", "net.au", "org.au", "co.jp",
+                    "ne.jp", "or.jp", "co.nz", "co.kr", "co.in", "com.br", "com.cn", "com.tw",
+                    "github.io", "gitlab.io", "blogspot.com", "herokuapp.com", "appspot.com"};
+        }
+
+        QSet<QByteArray> suffixes;
+        while (!file.atEnd()) {
+            const QByteArray line(file.readLine().trimmed());
+            if (line.isEmpty() || line.startsWith("//"))
+                continue;
+
+            const int prefix = line.startsWith('!') ? 1 : line.startsWith("*.") ? 2 : 0;
+            suffixes << line.left(prefix)
+                        + QUrl::toAce(QString::fromUtf8(line.mid(prefix))).toLower();
+        }
+        return suffixes;
+    }
+
+public:
+    static const QSet<QByteArray> &publicSuffixes() {
+        static const QSet<QByteArray> suffixes(loadPublicSuffixes());
+        return suffixes;
+    }
+
+    // The registrable domain of the host by the public suffix list, e.g. news.bbc.co.uk gives
+    // bbc.co.uk. Hosts under no listed suffix fall back to their last two labels.
+    static QByteArray baseDomain(const QByteArray &host) {
+        const QSet<QByteArray> &suffixes = publicSuffixes();
+        int previous = -1;
+        for (int from=0; ; ) {
+            const QByteArray candidate(host.mid(from));
+            if (suffixes.contains("!" + candidate))
+                return candidate;
+
+            const int dot = host.indexOf('.', from);
+            if (dot < 0 || suffixes.contains(candidate)
+                    || suffixes.contains("*." + host.mid(dot + 1)))
+                return previous < 0 ? host : host.mid(previous);
+
+            previous = from;
+            from = dot + 1;
+        }
+    }
+
+    static bool isThirdParty(const QUrl &url, const QUrl &firstParty) {
+        return !firstParty.isEmpty()
+            && baseDomain(url.host(QUrl::FullyEncoded).toLatin1())
+               != baseDomain(firstParty.host(QUrl::FullyEncoded).toLatin1());
+    }
+
+    void add(QByteArray line) {
+        line = line.trimmed();
+        if (line.isEmpty() || line.startsWith('!') || line.startsWith('[') || line.contains('#'))
+            return;
+
+        const bool exception = line.startsWith("@@");
+        if (exception)
+            line.remove(0, 2);
+
+        Rule rule{{}, false, false, false, AnyType & ~Document, AnyParty};
+        const int dollar = line.lastIndexOf('$');
+        if (dollar >= 0) {
+            if (!parseOptions(line.mid(dollar + 1).toLower(), rule.types, rule.party))
+                return;
+            line.truncate(dollar);
+        }
+        if (line.length() > 1 && line.startsWith('/') && line.endsWith('/'))
+            return;
+
+        if (line.startsWith("||"))
+            rule.hostAnchor = true;
+        else if (line.startsWith("|"))
+            rule.startAnchor = true;
+        line.remove(0, rule.hostAnchor ? 2 : rule.startAnchor ? 1 : 0);
+        if (line.endsWith('|')) {
+            rule.endAnchor = true;
+            line.chop(1);
+        }
+        line = line.toLower();
+
+        if (!exception && rule.hostAnchor && dollar < 0 && isDomain(line)) {
+            domains.insert(line.left(line.length() - 1));
+            count++;
+            return;
+        }
+
+        if (line.startsWith('*'))
+            rule.hostAnchor = rule.startAnchor = false;
+        if (line.endsWith('*'))
+            rule.endAnchor = false;
+        for (const QByteArray &part: line.split('*')) {
+            if (!part.isEmpty())
+                rule.parts << part;
+        }
+        if (rule.parts.isEmpty())
+            return;
+
+        Index &index = exception ? allow : block;
+        const QByteArray token(bestToken(line, rule));
+        if (token.isEmpty())
+            index.rest << rules.length();
+        else
+            index.tokens[hash(token.constData(), token.length())] << rules.length();
+        rules << rule;
+        count++;
+    }
+
+    void load(QIODevice &list) {
+        while (!list.atEnd())
+            add(list.readLine());
+    }
+
+    static TortaFilter *fromDirectory(const QString &path) {
+        publicSuffixes();
+        auto filter = new TortaFilter;
+        for (const QFileInfo &info: QDir(path).entryInfoList({"*.txt"}, QDir::Files)) {
+            QFile file(info.absoluteFilePath());
+            if (file.open(QIODevice::ReadOnly))
+                filter->load(file);
+        }
+        return filter;
+    }
+
+    int rulesCount() const {
+        return count;
+    }
+
+    bool blocks(const QUrl &url, const QUrl &firstParty, int type) const {
+        const QByteArray host(url.host(QUrl::FullyEncoded).toLatin1());
+        const QByteArray encoded(url.toEncoded().toLower());
+        const int hostBegin = qMax(0, encoded.indexOf(host, qMax(0, encoded.indexOf("//"))));
+        const int hostEnd = hostBegin + host.length();
+        const bool third = isThirdParty(url, firstParty);
+
+        bool blocked = false;
+        for (int from=0; from >= 0 && !blocked && (type & Document) == 0; ) {
+            blocked = domains.contains(QByteArray::fromRawData(host.constData() + from,
+                                                               host.length() - from));
+            from = host.indexOf('.', from);
+            from = from < 0 ? -1 : from + 1;
+        }
+        blocked = blocked || search(block, encoded.constData(), encoded.length(),
+                                    hostBegin, hostEnd, type, third);
+
+        return blocked && !search(allow, encoded.constData(), encoded.length(),
+                                  hostBegin, hostEnd, type, third);
+    }
+};
+
+
+#endif
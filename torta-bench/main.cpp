@@ -0,0 +1,518 @@
+#include "dobostorta.h"
+
+
+struct Request {
+    QUrl url;
+    QUrl firstParty;
+};
+
+
+QVector<Request> syntheticRequests(int count) {
+    const QStringList hosts{
+        "www.example.com", "cdn.example.net", "static.news.co.uk", "i.imgur.com",
+        "ads.doubleclick.net", "www.google-analytics.com", "pagead2.googlesyndication.com",
+        "tracker.example.org", "api.github.com", "fonts.gstatic.com",
+    };
+    const QStringList words{
+        "ads", "banner", "track", "pixel", "static", "img", "js", "api", "video", "assets",
+        "analytics", "cdn", "user", "v2", "gen_204", "collect", "widget", "thumb",
+    };
+    const QStringList extensions{".js", ".css", ".png", ".jpg", ".html", ""};
+
+    QRandomGenerator random(42);
+    auto pick = [&random](const QStringList &list){
+        return list[random.bounded(list.length())];
+    };
+
+    QVector<Request> requests;
+    requests.reserve(count);
+    for (int i=0; i < count; i++) {
+        QString path;
+        for (int j=random.bounded(1, 6); j > 0; j--)
+            path += "/" + pick(words);
+        path += QString::number(random.bounded(100000)) + pick(extensions);
+        if (random.bounded(3) == 0)
+            path += QString("?id=%1&utm_source=%2").arg(random.bounded(1000)).arg(pick(words));
+
+        requests << Request{QUrl("https://" + pick(hosts) + path),
+                            QUrl("https://" + hosts[random.bounded(4)] + "/")};
+    }
+    return requests;
+}
+
+
+QVector<Request> loadRequests(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning().noquote() << "can't open" << path;
+        return {};
+    }
+
+    QVector<Request> requests;
+    while (!file.atEnd()) {
+        const QStringList fields(QString(file.readLine()).split(' ', Qt::SkipEmptyParts));
+        if (!fields.isEmpty())
+            requests << Request{QUrl(fields[0].trimmed()),
+                                QUrl(fields.value(1).trimmed())};
+    }
+    return requests;
+}
+
+
+qint64 percentile(QVector<qint64> &sorted, double p) {
+    return sorted.isEmpty() ? 0 : sorted[qMin(sorted.length() - 1, int(sorted.length() * p))];
+}
+
+
+QJsonObject benchFilter(const QCommandLineParser &parser, const QStringList &lists) {
+    QElapsedTimer timer;
+    timer.start();
+    TortaFilter filter;
+    for (const QString &path: lists) {
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly))
+            filter.load(file);
+        else
+            qWarning().noquote() << "can't open" << path;
+    }
+    const qint64 compile = timer.elapsed();
+
+    const QVector<Request> requests(parser.isSet("urls")
+                                    ? loadRequests(parser.value("urls"))
+                                    : syntheticRequests(parser.value("count").toInt()));
+
+    for (const Request &r: requests)
+        filter.blocks(r.url, r.firstParty, TortaFilter::Other);
+
+    QVector<qint64> times;
+    times.reserve(requests.length());
+    int blocked = 0;
+    qint64 total = 0;
+    for (const Request &r: requests) {
+        timer.start();
+        blocked += filter.blocks(r.url, r.firstParty, TortaFilter::Other);
+        times << timer.nsecsElapsed();
+        total += times.last();
+    }
+    std::sort(times.begin(), times.end());
+
+    return {
+        {"benchmark", "filter"},
+        {"rules", filter.rulesCount()},
+        {"compile_ms", compile},
+        {"urls", requests.length()},
+        {"blocked", blocked},
+        {"mean_ns", requests.isEmpty() ? 0 : total / requests.length()},
+        {"p50_ns", percentile(times, 0.5)},
+        {"p99_ns", percentile(times, 0.99)},
+        {"max_ns", times.isEmpty() ? 0 : times.last()},
+    };
+}
+
+
+void wait(QEventLoop &loop, int timeout) {
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    timer.start(timeout);
+    loop.exec();
+}
+
+
+QJsonObject measurePage(TortaDatabase &db, const QString &url, int timeout) {
+    auto torta = new DobosTorta(db);
+    auto view = torta->findChild<QWebEngineView *>();
+
+    QEventLoop loop;
+    QElapsedTimer timer;
+    qint64 loaded = -1;
+    QObject::connect(view, &QWebEngineView::loadFinished, &loop, [&](bool ok){
+        loaded = ok ? timer.elapsed() : -1;
+        loop.quit();
+    });
+    timer.start();
+    torta->load(url);
+    wait(loop, timeout);
+
+    double paint = -1;
+    view->page()->runJavaScript("(performance.getEntriesByName('first-contentful-paint')[0]"
+                                " || {startTime: -1}).startTime",
+                                [&](const QVariant &v){ paint = v.toDouble(); loop.quit(); });
+    wait(loop, timeout);
+
+    const QJsonObject result{
+        {"url", url},
+        {"load_ms", loaded},
+        {"first_paint_ms", paint >= 0 ? QJsonValue(paint) : QJsonValue()},
+        {"renderer_rss_kb", residentKB(view->page()->renderProcessPid())},
+    };
+    delete torta;
+    return result;
+}
+
+
+QJsonObject measureWindows(TortaDatabase &db, const QStringList &urls, int count, int timeout) {
+    QEventLoop loop;
+    QElapsedTimer timer;
+    QVector<DobosTorta *> windows;
+    QSet<DobosTorta *> loaded;
+
+    timer.start();
+    for (int i=0; i < count; i++) {
+        auto torta = new DobosTorta(db);
+        QObject::connect(torta->findChild<QWebEngineView *>(), &QWebEngineView::loadFinished,
+                         &loop, [&, torta]{
+            loaded << torta;
+            if (loaded.size() == count)
+                loop.quit();
+        });
+        torta->load(urls[i % urls.length()]);
+        windows << torta;
+    }
+    const qint64 opened = timer.elapsed();
+    wait(loop, timeout);
+    const qint64 finished = loaded.size() == count ? timer.elapsed() : -1;
+
+    QSet<qint64> pids;
+    qint64 renderers = 0;
+    for (DobosTorta *torta: windows) {
+        const qint64 pid = torta->findChild<QWebEngineView *>()->page()->renderProcessPid();
+        if (!pids.contains(pid))
+            renderers += residentKB(pid);
+        pids << pid;
+    }
+
+    const QJsonObject result{
+        {"windows", count},
+        {"open_ms", opened},
+        {"load_ms", finished},
+        {"browser_rss_kb", residentKB(QCoreApplication::applicationPid())},
+        {"renderer_rss_kb", renderers},
+        {"renderers", pids.size()},
+    };
+    qDeleteAll(windows);
+    return result;
+}
+
+
+QJsonObject benchLoad(const QCommandLineParser &parser, QStringList urls) {
+    if (urls.isEmpty()) {
+        for (const QFileInfo &info: QDir(FIXTURES).entryInfoList({"*.html"}, QDir::Files))
+            urls << QUrl::fromLocalFile(info.absoluteFilePath()).toString();
+    }
+    const int timeout = parser.value("timeout").toInt();
+
+    QTemporaryDir dir;
+    TortaDatabase db(0, dir.filePath("history"));
+
+    QJsonArray pages;
+    for (int round=0; round < parser.value("repeat").toInt(); round++) {
+        for (const QString &url: urls) {
+            QJsonObject page(measurePage(db, url, timeout));
+            page["round"] = round;
+            pages << page;
+        }
+    }
+
+    return {
+        {"benchmark", "load"},
+        {"version", GIT_VERSION},
+        {"pages", pages},
+        {"windows", measureWindows(db, urls, parser.value("windows").toInt(), timeout)},
+    };
+}
+
+
+class Zipf {
+    QVector<double> cumulative;
+
+public:
+    Zipf(int n, double exponent=1.0) {
+        double sum = 0;
+        cumulative.reserve(n);
+        for (int i=1; i <= n; i++)
+            cumulative << (sum += 1.0 / std::pow(i, exponent));
+    }
+
+    int operator()(QRandomGenerator &random) const {
+        const double x = random.generateDouble() * cumulative.last();
+        return std::upper_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin();
+    }
+};
+
+
+struct History {
+    QStringList schemes;
+    QStringList addresses;
+    Zipf popularity;
+    int visited;
+    int autoVacuum;
+};
+
+
+History generateHistory(const QString &path, int visits, QRandomGenerator &random) {
+    const QStringList syllables{
+        "ka", "to", "mi", "ra", "no", "su", "be", "lo", "da", "ve", "xi", "qu", "an", "el", "or",
+    };
+    const QStringList tlds{".com", ".org", ".net", ".io", ".co.jp", ".de"};
+    const QStringList words{
+        "news", "blog", "wiki", "docs", "search", "user", "issues", "2019", "archive", "api",
+        "video", "watch", "article", "tag", "release", "download", "qt", "linux", "cake",
+    };
+    auto pick = [&random](const QStringList &list){
+        return list[random.bounded(list.length())];
+    };
+
+    QStringList hosts;
+    for (int i=qMax(20, visits / 200); i > 0; i--) {
+        QString host;
+        for (int j=random.bounded(2, 4); j > 0; j--)
+            host += pick(syllables);
+        hosts << (random.bounded(5) == 0 ? "www." : "") + host + pick(tlds);
+    }
+    const Zipf hostPopularity(hosts.length());
+
+    History history{{}, {}, Zipf(qMax(100, visits / 4)), 0, 0};
+    for (int i=qMax(100, visits / 4); i > 0; i--) {
+        if (random.bounded(30) == 0) {
+            QStringList terms;
+            for (int j=random.bounded(1, 4); j > 0; j--)
+                terms << pick(words);
+            history.schemes << "search";
+            history.addresses << terms.join(' ');
+            continue;
+        }
+
+        QString address("//" + hosts[hostPopularity(random)]);
+        for (int j=random.bounded(4); j > 0; j--)
+            address += "/" + pick(words);
+        if (random.bounded(4) == 0)
+            address += QString("?id=%1").arg(random.bounded(100000));
+        history.schemes << (random.bounded(8) == 0 ? "http" : "https");
+        history.addresses << address;
+    }
+
+    { TortaDatabase schema(0, path); }
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "torta-bench");
+    db.setDatabaseName(path);
+    db.open();
+
+    QSqlQuery mode("PRAGMA auto_vacuum", db);
+    history.autoVacuum = mode.next() ? mode.value(0).toInt() : -1;
+    mode.finish();
+    if (history.autoVacuum != 2)
+        qCritical() << "new history database is not in incremental auto_vacuum mode";
+
+    db.transaction();
+
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    QHash<int, qint64> visitCount, lastVisit;
+    QHash<int, double> score;
+    QSqlQuery visit(db);
+    visit.prepare("INSERT INTO visits (url_id, timestamp) VALUES (?, ?)");
+    for (int i=0; i < visits; i++) {
+        const int id = history.popularity(random) + 1;
+        const qint64 timestamp = now - random.bounded(365 * 24 * 60 * 60);
+        visitCount[id]++;
+        lastVisit[id] = qMax(lastVisit.value(id), timestamp);
+        score[id] = frecency(score.value(id), timestamp);
+        visit.addBindValue(id);
+        visit.addBindValue(timestamp);
+        visit.exec();
+    }
+
+    QSqlQuery url(db);
+    url.prepare("INSERT OR IGNORE INTO urls                                           \
+                   (id, scheme, address, visit_count, last_visit, frecency)          \
+                 VALUES (?, ?, ?, ?, ?, ?)                                           ");
+    for (auto it=visitCount.constBegin(); it != visitCount.constEnd(); it++) {
+        url.addBindValue(it.key());
+        url.addBindValue(history.schemes[it.key() - 1]);
+        url.addBindValue(history.addresses[it.key() - 1]);
+        url.addBindValue(it.value());
+        url.addBindValue(lastVisit[it.key()]);
+        url.addBindValue(score[it.key()]);
+        url.exec();
+    }
+
+    history.visited = visitCount.size();
+
+    db.commit();
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase("torta-bench");
+    return history;
+}
+
+
+QStringList loadSessions(const QStringList &paths) {
+    QStringList sessions;
+    for (const QString &path: paths) {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qWarning().noquote() << "can't open" << path;
+            continue;
+        }
+        while (!file.atEnd()) {
+            const QString line(QString(file.readLine()).trimmed());
+            if (!line.isEmpty())
+                sessions << line;
+        }
+    }
+    return sessions;
+}
+
+
+QStringList syntheticSessions(const History &history, int count, QRandomGenerator &random) {
+    QStringList sessions;
+    for (int i=0; i < count; i++) {
+        const int id = history.popularity(random);
+        if (history.schemes[id] == "search") {
+            sessions << history.addresses[id];
+        } else {
+            QString host(QUrl("http:" + history.addresses[id]).host());
+            if (host.startsWith("www."))
+                host.remove(0, 4);
+            sessions << host;
+        }
+    }
+    return sessions;
+}
+
+
+QJsonObject replaySessions(TortaDatabase &db, const QStringList &sessions) {
+    QHash<QString, QVector<qint64>> times;
+    QElapsedTimer timer;
+    auto measure = [&](const QString &name, const std::function<void()> &operation){
+        timer.start();
+        operation();
+        times[name] << timer.nsecsElapsed();
+    };
+
+    for (const QString &typed: sessions) {
+        for (int i=1; i <= typed.length(); i++) {
+            const QString word(typed.left(i));
+            const QStringList query(word.split(' ', Qt::SkipEmptyParts));
+            measure("firstForwardMatch", [&]{ db.firstForwardMatch(word); });
+            measure("search", [&]{ db.search(query, SUGGEST_FIRST); });
+            measure("searchAll", [&]{ db.search(query, SUGGEST_LIMIT); });
+        }
+
+        if (guessQueryType(typed) == URLWithoutScheme) {
+            QUrl url;
+            measure("expandAbridgedAddress", [&]{ url = db.expandAbridgedAddress(typed); });
+            const QString address(url.url().remove(0, url.scheme().length() + 1));
+            measure("append", [&]{ db.append(url.scheme(), address); });
+        } else {
+            measure("append", [&]{ db.append("search", typed); });
+        }
+    }
+    measure("flush", [&]{ db.flush(); });
+
+    QJsonObject result;
+    for (auto it=times.begin(); it != times.end(); it++) {
+        std::sort(it->begin(), it->end());
+        result[it.key()] = QJsonObject{
+            {"count", it->length()},
+            {"p50_ns", percentile(*it, 0.5)},
+            {"p99_ns", percentile(*it, 0.99)},
+            {"max_ns", it->last()},
+        };
+    }
+    return result;
+}
+
+
+QJsonObject benchHistory(const QCommandLineParser &parser, const QStringList &sessionFiles) {
+    QRandomGenerator random(42);
+    const QStringList recorded(loadSessions(sessionFiles));
+
+    QJsonArray results;
+    for (const QString &size: parser.value("sizes").split(',', Qt::SkipEmptyParts)) {
+        QTemporaryDir dir;
+        const QString path(dir.filePath("history"));
+
+        QElapsedTimer timer;
+        timer.start();
+        const History history(generateHistory(path, size.toInt(), random));
+        const qint64 generated = timer.elapsed();
+
+        timer.start();
+        QScopedPointer<TortaDatabase> db(new TortaDatabase(0, path));
+        const qint64 opened = timer.elapsed();
+
+        const QStringList sessions(!recorded.isEmpty()
+                                   ? recorded
+                                   : syntheticSessions(history,
+                                                       parser.value("sessions").toInt(), random));
+        const QJsonObject operations(replaySessions(*db, sessions));
+        db.reset();
+
+        qint64 bytes = 0;
+        for (const QFileInfo &info: QDir(dir.path()).entryInfoList({"history*"}, QDir::Files))
+            bytes += info.size();
+
+        results << QJsonObject{
+            {"visits", size.toInt()},
+            {"urls", history.visited},
+            {"sessions", sessions.length()},
+            {"generate_ms", generated},
+            {"open_ms", opened},
+            {"file_bytes", bytes},
+            {"auto_vacuum", history.autoVacuum},
+            {"operations", operations},
+        };
+    }
+
+    return {
+        {"benchmark", "history"},
+        {"version", GIT_VERSION},
+        {"results", results},
+    };
+}
+
+
+int main(int argc, char **argv) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    app.setApplicationName("Torta-Bench");
+    app.setApplicationVersion(GIT_VERSION);
+
+    QCommandLineParser parser;
+    parser.addPositionalArgument("benchmark", "benchmark to run: filter, load or history");
+    parser.addPositionalArgument("FILE...", "filter lists for filter, pages for load, "
+                                            "or typing sessions for history");
+    parser.addOption(QCommandLineOption("urls", "URL corpus, one \"URL [FIRST-PARTY]\" per line",
+                                        "FILE"));
+    parser.addOption(QCommandLineOption("count", "number of synthetic URLs", "N", "100000"));
+    parser.addOption(QCommandLineOption("repeat", "times to load each page", "N", "3"));
+    parser.addOption(QCommandLineOption("windows", "number of windows to open at once",
+                                        "N", "10"));
+    parser.addOption(QCommandLineOption("timeout", "timeout of each load", "ms", "30000"));
+    parser.addOption(QCommandLineOption("sizes", "visits of synthetic histories", "N,...",
+                                        "10000,100000,1000000"));
+    parser.addOption(QCommandLineOption("sessions", "number of synthetic typing sessions",
+                                        "N", "200"));
+    parser.addHelpOption();
+    parser.process(app);
+
+    QStringList args(parser.positionalArguments());
+    if (args.isEmpty())
+        parser.showHelp(1);
+    const QString benchmark(args.takeFirst());
+
+    QJsonObject result;
+    if (benchmark == "filter")
+        result = benchFilter(parser, args);
+    else if (benchmark == "load")
+        result = benchLoad(parser, args);
+    else if (benchmark == "history")
+        result = benchHistory(parser, args);
+    else
+        parser.showHelp(1);
+
+    QTextStream(stdout) << QJsonDocument(result).toJson(QJsonDocument::Compact) << "\n";
+    return 0;
+}
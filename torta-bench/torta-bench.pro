@@ -0,0 +1,14 @@
+TEMPLATE = app
+TARGET = torta-bench
+INCLUDEPATH += . ../dobostorta ../torta-dl
+
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += GIT_VERSION=\\\"$$system(git describe --always --tags --dirty)\\\"
+DEFINES += FIXTURES=\\\"$$PWD/fixtures\\\"
+
+QT += widgets webengine webenginewidgets sql network
+
+HEADERS += ../dobostorta/dobostorta.h ../dobostorta/filter.h ../torta-dl/request.h
+SOURCES += main.cpp
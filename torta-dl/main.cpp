@@ -1,11 +1,26 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <limits>
+
 #include <QtNetwork>
 #include <QtWidgets>
 
+#include "request.h"
+
 
 #define USER_AGENT  "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)" \
                     "Chrome/70.0.0.0 Safari/537.36 Dobostorta/" GIT_VERSION
 
-#define CONNECTION_NAME  "dobostorta-downloader.sock"
+#define CONNECTION_NAME  DOWNLOADER_CONNECTION_NAME
+#define REQUEST_TIMEOUT  5000
+
+#define DOWNLOAD_BUFFER_SIZE  (1024 * 1024)
+#define DOWNLOAD_CONNECTIONS  4
+#define SEGMENT_MIN_SIZE      (4 * 1024 * 1024)
+#define DOWNLOAD_MAX          3
+#define DOWNLOAD_MAX_PER_HOST 2
+#define RATE_TICK             100
 
 
 class TortaRequestHandler : public QLocalServer {
@@ -17,15 +32,32 @@ Q_OBJECT
     }
 
     void newConnection() {
-        QLocalSocket *sock = nextPendingConnection();
-        connect(sock, &QLocalSocket::disconnected, sock, &QLocalSocket::close);
+        while (hasPendingConnections()) {
+            QLocalSocket *sock = nextPendingConnection();
+            connect(sock, &QLocalSocket::disconnected, sock, &QObject::deleteLater);
+            connect(sock, &QLocalSocket::readyRead, this, [this, sock]{ receive(sock); });
+        }
+    }
 
-        sock->waitForReadyRead();
+    void receive(QLocalSocket *sock) {
+        QVector<TortaRequest> received;
+        QByteArray payload;
+        while (TortaRequest::readFrame(sock, payload)) {
+            QVector<TortaRequest> requests;
+            const bool valid = TortaRequest::unpack(payload, requests);
+            QVector<bool> accepted;
+            for (const TortaRequest &request: requests)
+                accepted << (valid && request.url.isValid());
+            sock->write(TortaRequest::packAck(accepted));
+
+            for (const TortaRequest &request: requests) {
+                if (valid && request.url.isValid())
+                    received << request;
+            }
+        }
 
-        QDataStream stream(sock);
-        QByteArray data;
-        stream >> data;
-        emit receivedRequest({data});
+        if (!received.isEmpty())
+            emit receivedRequests(received);
     }
 
 public:
@@ -38,71 +70,488 @@ public:
         if (server->isListening())
             return server;
 
+        QLocalSocket probe;
+        probe.connectToServer(CONNECTION_NAME);
+        if (!probe.waitForConnected(1000)) {
+            QLocalServer::removeServer(CONNECTION_NAME);
+            if (server->listen(CONNECTION_NAME))
+                return server;
+        }
+
         delete server;
         return nullptr;
     }
 
-    static bool request(const QUrl &url) {
+    static bool request(const QVector<TortaRequest> &requests) {
         QLocalSocket sock;
         sock.connectToServer(CONNECTION_NAME);
-
-        if (!sock.isValid()) {
+        if (!sock.waitForConnected(1000)) {
             qCritical() << tr("Failed to open socket: ") << sock.errorString();
             return false;
         }
 
-        QByteArray block;
-        QDataStream stream(&block, QIODevice::WriteOnly);
-        stream << url.toEncoded();
-        sock.write(block);
+        sock.write(TortaRequest::pack(requests));
 
-        sock.waitForBytesWritten();
+        QByteArray payload;
+        while (!TortaRequest::readFrame(&sock, payload)) {
+            if (!sock.waitForReadyRead(REQUEST_TIMEOUT)) {
+                qCritical() << tr("No response from downloader: ") << sock.errorString();
+                return false;
+            }
+        }
 
-        return true;
+        QVector<bool> accepted;
+        return TortaRequest::unpackAck(payload, accepted)
+               && accepted.size() == requests.size() && !accepted.contains(false);
     }
 
-    static bool request(const QStringList &urls) {
-        bool success = true;
-        for (auto url: urls)
-            success = success && request(QUrl(url));
-        return success;
+signals:
+    void receivedRequests(const QVector<TortaRequest> &requests);
+};
+
+
+class TortaRateLimit {
+    qint64 rate;
+    qint64 tokens;
+
+public:
+    explicit TortaRateLimit(qint64 rate=0) : rate(rate), tokens(rate * RATE_TICK / 1000) {}
+
+    qint64 available() const {
+        return rate > 0 ? tokens : std::numeric_limits<qint64>::max();
     }
 
-signals:
-    void receivedRequest(const QUrl &url);
+    void take(qint64 bytes) {
+        tokens -= bytes;
+    }
+
+    void refill(qint64 elapsed) {
+        tokens = qMin(rate * RATE_TICK * 2 / 1000, tokens + rate * elapsed / 1000);
+    }
+};
+
+
+template <class Download> class TortaScheduler : public QObject {
+    struct Entry {
+        Download *download;
+        int priority;
+    };
+
+    QNetworkAccessManager manager;
+    QLabel &status;
+    const int maxDownloads;
+    const int maxPerHost;
+    const qint64 downloadRate;
+    TortaRateLimit limit;
+    QHash<Download *, TortaRateLimit> running;
+    QList<Entry> queue;
+    QHash<Download *, int> paused;
+    QTimer timer;
+    QElapsedTimer clock;
+
+
+    int runningOn(const QString &host) const {
+        int count = 0;
+        for (auto it = running.constBegin(); it != running.constEnd(); it++)
+            count += it.key()->host() == host ? 1 : 0;
+        return count;
+    }
+
+    int takeQueued(Download *download) {
+        for (int i=0; i < queue.length(); i++) {
+            if (queue[i].download == download)
+                return queue.takeAt(i).priority;
+        }
+        return paused.take(download);
+    }
+
+    void schedule() {
+        for (int i=0; i < queue.length(); ) {
+            Download *download = queue[i].download;
+            if (maxDownloads > 0 && running.size() >= maxDownloads)
+                break;
+            if (maxPerHost > 0 && runningOn(download->host()) >= maxPerHost) {
+                i++;
+                continue;
+            }
+            queue.removeAt(i);
+            running.insert(download, TortaRateLimit(downloadRate));
+            download->start();
+        }
+
+        for (int i=0; i < queue.length(); i++)
+            queue[i].download->queued(i + 1);
+        for (auto it = paused.constBegin(); it != paused.constEnd(); it++)
+            it.key()->queued(0);
+
+        QStringList summary;
+        if (!running.isEmpty())
+            summary << QString("%1 downloading").arg(running.size());
+        if (!queue.isEmpty())
+            summary << QString("%1 queued").arg(queue.length());
+        if (!paused.isEmpty())
+            summary << QString("%1 paused").arg(paused.size());
+        status.setText(summary.join(", "));
+        status.setVisible(!summary.isEmpty());
+    }
+
+public:
+    TortaScheduler(QLabel &status, int maxDownloads, int maxPerHost, qint64 rate,
+                   qint64 downloadRate)
+            : status(status), maxDownloads(maxDownloads), maxPerHost(maxPerHost),
+              downloadRate(downloadRate), limit(rate) {
+        status.hide();
+
+        connect(&timer, &QTimer::timeout, [this]{
+            const qint64 elapsed = clock.restart();
+            limit.refill(elapsed);
+            for (auto it = running.begin(); it != running.end(); it++)
+                it->refill(elapsed);
+            for (Download *download: running.keys())
+                download->drain();
+        });
+        if (rate > 0 || downloadRate > 0) {
+            timer.start(RATE_TICK);
+            clock.start();
+        }
+    }
+
+    QNetworkReply *get(const QNetworkRequest &request) {
+        return manager.get(request);
+    }
+
+    QNetworkReply *head(const QNetworkRequest &request) {
+        return manager.head(request);
+    }
+
+    QNetworkCookieJar *cookieJar() const {
+        return manager.cookieJar();
+    }
+
+    void enqueue(Download *download, int priority=0) {
+        takeQueued(download);
+        int i = 0;
+        while (i < queue.length() && queue[i].priority >= priority)
+            i++;
+        queue.insert(i, Entry{download, priority});
+        schedule();
+    }
+
+    void prioritize(Download *download) {
+        if (!queue.isEmpty())
+            enqueue(download, queue.first().priority + 1);
+    }
+
+    void pause(Download *download) {
+        const int priority = takeQueued(download);
+        running.remove(download);
+        download->pause();
+        paused.insert(download, priority);
+        schedule();
+    }
+
+    void resume(Download *download) {
+        enqueue(download, paused.value(download));
+    }
+
+    void remove(Download *download) {
+        takeQueued(download);
+        running.remove(download);
+        schedule();
+    }
+
+    qint64 budget(Download *download) const {
+        return qMin(limit.available(), running.value(download).available());
+    }
+
+    void consume(Download *download, qint64 bytes) {
+        limit.take(bytes);
+        const auto it = running.find(download);
+        if (it != running.end())
+            it->take(bytes);
+    }
 };
 
 
 class TortaDownload : public QWidget {
 Q_OBJECT
 
-    QNetworkReply * const reply;
+    struct Segment {
+        QNetworkReply *reply;
+        qint64 pos;
+        qint64 end;
+        bool accepted;
+    };
+
+    enum State {
+        Queued,
+        Running,
+        Paused,
+        Failed,
+        Done
+    };
+
+    TortaScheduler<TortaDownload> &scheduler;
+    const QNetworkRequest request;
+    QFile * const file;
+    const QString filePath;
+    const int connections;
     QVBoxLayout layout;
     QProgressBar progress;
     QPushButton actionButton;
+    QPushButton pauseButton;
+    QPushButton firstButton;
     QPushButton clearButton;
     QTimer intervalTimer;
     QElapsedTimer elapsedTimer;
+    QVector<Segment> segments;
+    QByteArray validator;
+    qint64 offset = 0;
+    qint64 received = 0;
+    qint64 total = -1;
+    State state = Queued;
+    bool canceled = false;
 
 
-    void saveTo(const QString &path) {
-        QFile file(path);
-        if (!file.open(QIODevice::WriteOnly)) {
-            QMessageBox message(QMessageBox::Critical,
-                                reply->url().toString(),
-                                tr("Failed create %1\n%2").arg(path, file.errorString()),
-                                QMessageBox::Retry | QMessageBox::Abort,
-                                this);
-            if (message.exec() == QMessageBox::Retry)
-                saveTo(path);
+    static QString statePath(const QString &filePath) {
+        return filePath + ".part.state";
+    }
+
+    static QByteArray validatorOf(const QNetworkReply *reply) {
+        if (reply->rawHeader("Accept-Ranges") == "none")
+            return QByteArray();
+        const QByteArray etag(reply->rawHeader("ETag"));
+        return !etag.isEmpty() && !etag.startsWith("W/") ? etag : reply->rawHeader("Last-Modified");
+    }
+
+    int segmentOf(const QNetworkReply *reply) const {
+        for (int i=0; i < segments.length(); i++) {
+            if (segments[i].reply == reply)
+                return i;
+        }
+        return -1;
+    }
+
+    bool segmented() const {
+        return std::any_of(segments.begin(), segments.end(),
+                           [](const Segment &segment){ return segment.end >= 0; });
+    }
+
+    void saveState() const {
+        if (validator.isEmpty()) {
+            QFile::remove(statePath(filePath));
+            return;
+        }
+
+        QJsonObject saved{
+            {"url", request.url().toString()},
+            {"validator", QString(validator)},
+        };
+        if (segmented()) {
+            QJsonArray ranges;
+            for (const Segment &segment: segments) {
+                ranges << QJsonArray{static_cast<double>(segment.pos),
+                                     static_cast<double>(segment.end)};
+            }
+            saved["size"] = static_cast<double>(total);
+            saved["segments"] = ranges;
+        }
+
+        QSaveFile stateFile(statePath(filePath));
+        if (stateFile.open(QIODevice::WriteOnly)) {
+            stateFile.write(QJsonDocument(saved).toJson());
+            stateFile.commit();
+        }
+    }
+
+    void drop(QNetworkReply *reply) {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    void fetch(qint64 pos, qint64 end) {
+        QNetworkRequest ranged(request);
+        if (pos > 0 || end >= 0) {
+            ranged.setRawHeader("Range", "bytes=" + QByteArray::number(pos) + "-"
+                                         + (end >= 0 ? QByteArray::number(end - 1) : QByteArray()));
+            if (!validator.isEmpty())
+                ranged.setRawHeader("If-Range", validator);
+        }
+
+        QNetworkReply *reply = scheduler.get(ranged);
+        reply->setParent(this);
+        reply->setReadBufferSize(DOWNLOAD_BUFFER_SIZE);
+        segments << Segment{reply, pos, end, false};
+
+        connect(reply, &QNetworkReply::metaDataChanged, this, [this, reply]{ started(reply); });
+        connect(reply, &QNetworkReply::readyRead, this, [this, reply]{ write(reply); });
+        connect(reply, &QNetworkReply::finished, this, [this, reply]{ segmentFinished(reply); });
+    }
+
+    void probe() {
+        QNetworkReply *reply = scheduler.head(request);
+        reply->setParent(this);
+        connect(reply, &QNetworkReply::finished, this, [this, reply]{
+            reply->deleteLater();
+
+            const qint64 length = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+            const int count = qMin<qint64>(connections, length / SEGMENT_MIN_SIZE);
+            if (reply->error() || reply->rawHeader("Accept-Ranges") != "bytes" || count < 2) {
+                file->resize(0);
+                fetch(0, -1);
+                return;
+            }
+
+            if (!file->resize(length)) {
+                fail(tr("Failed allocate %1\n%2").arg(file->fileName(), file->errorString()));
+                return;
+            }
+            validator = validatorOf(reply);
+            total = length;
+            for (int i=0; i < count; i++)
+                fetch(length * i / count, length * (i + 1) / count);
+            saveState();
+            updateProgress();
+        });
+    }
+
+    void restart() {
+        for (const Segment &segment: segments)
+            drop(segment.reply);
+        segments.clear();
+        QFile::remove(statePath(filePath));
+        validator.clear();
+        file->resize(0);
+        offset = received = 0;
+        total = -1;
+        fetch(0, -1);
+    }
+
+    void started(QNetworkReply *reply) {
+        const int i = segmentOf(reply);
+        if (i < 0 || segments[i].accepted)
+            return;
+
+        Segment &segment = segments[i];
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        const QByteArray range(reply->rawHeader("Content-Range"));
+        const bool single = segment.end < 0;
+        if (status == 206 && range.startsWith("bytes " + QByteArray::number(segment.pos) + "-")) {
+            const qint64 length = range.mid(range.indexOf('/') + 1).toLongLong();
+            if (single)
+                total = length > 0 ? length : -1;
+        } else if ((status == 200 || (status == 0 && !reply->error())) && single) {
+            file->resize(0);
+            offset = received = segment.pos = 0;
+            const QVariant length(reply->header(QNetworkRequest::ContentLengthHeader));
+            total = length.isValid() ? length.toLongLong() : -1;
+        } else if (status == 200 || status == 206 || status == 416) {
+            restart();
+            return;
+        } else {
             return;
         }
+        segment.accepted = true;
 
-        file.write(reply->readAll());
-        file.close();
+        if (single) {
+            validator = validatorOf(reply);
+            saveState();
+        }
+        updateProgress();
     }
 
-    static QString bytesToKMG(int bytes) {
+    void write(QNetworkReply *reply) {
+        const int i = segmentOf(reply);
+        if (i < 0 || !segments[i].accepted)
+            return;
+
+        Segment &segment = segments[i];
+        while (reply->bytesAvailable() > 0 && (segment.end < 0 || segment.pos < segment.end)) {
+            qint64 size = qMin<qint64>(DOWNLOAD_BUFFER_SIZE, scheduler.budget(this));
+            if (segment.end >= 0)
+                size = qMin(size, segment.end - segment.pos);
+            if (size <= 0)
+                break;
+
+            const QByteArray chunk(reply->read(size));
+            if ((file->pos() != segment.pos && !file->seek(segment.pos))
+                    || file->write(chunk) != chunk.size()) {
+                fail(tr("Failed write %1\n%2").arg(file->fileName(), file->errorString()));
+                return;
+            }
+            scheduler.consume(this, chunk.size());
+            segment.pos += chunk.size();
+            received += chunk.size();
+        }
+        updateProgress();
+
+        if (segment.end >= 0 && segment.pos >= segment.end)
+            segmentDone(i);
+        else if (reply->isFinished() && !reply->error() && reply->bytesAvailable() == 0)
+            segment.end < 0 ? segmentDone(i)
+                            : fail(tr("Connection closed before the end of the range"));
+    }
+
+    void segmentFinished(QNetworkReply *reply) {
+        started(reply);
+
+        const int i = segmentOf(reply);
+        if (i < 0)
+            return;
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (reply->error())
+            fail(reply->errorString());
+        else if (!segments[i].accepted)
+            fail(tr("Unexpected response %1").arg(status));
+        else
+            write(reply);
+    }
+
+    void segmentDone(int i) {
+        drop(segments[i].reply);
+        segments.remove(i);
+        if (segments.isEmpty())
+            finish(true, QString());
+        else
+            steal();
+    }
+
+    void steal() {
+        auto left = [this](int i){ return segments[i].end - segments[i].pos; };
+
+        int victim = -1;
+        for (int i=0; i < segments.length(); i++) {
+            if (segments[i].end >= 0 && (victim < 0 || left(i) > left(victim)))
+                victim = i;
+        }
+        if (victim < 0 || left(victim) < 2 * SEGMENT_MIN_SIZE)
+            return;
+
+        const qint64 end = segments[victim].end;
+        segments[victim].end = (segments[victim].pos + end) / 2;
+        fetch(segments[victim].end, end);
+    }
+
+    void stop() {
+        for (auto reply: findChildren<QNetworkReply *>())
+            drop(reply);
+        file->flush();
+        if (state == Running)
+            saveState();
+        segments.clear();
+        intervalTimer.stop();
+    }
+
+    void fail(const QString &error) {
+        if (state == Failed || state == Done)
+            return;
+
+        stop();
+        finish(false, error);
+    }
+
+    static QString bytesToKMG(qint64 bytes) {
         static const char* units[] = {"B", "KB", "MB", "GB", "TB", "PB", nullptr};
         for (int i=0; units[i+1] != nullptr; i++) {
             if (bytes < qPow(1024, i + 1)) {
@@ -127,26 +576,46 @@ Q_OBJECT
         progress.setPalette(p);
     }
 
-    void finished(const QString &filePath) {
-        clearButton.show();
+    void updateProgress() {
+        progress.setRange(0, total > 0 ? 1000 : 0);
+        progress.setValue(total > 0 ? received * 1000 / total : 0);
+        updateProgressFormat();
+    }
 
+    void finish(bool success, QString error) {
+        state = Failed;
+        scheduler.remove(this);
+        clearButton.show();
+        pauseButton.hide();
+        firstButton.hide();
         intervalTimer.stop();
-        if (!reply->error()) {
-            saveTo(filePath);
-            progress.setFormat(QString("done [%1]").arg(bytesToKMG(progress.maximum())));
+
+        file->close();
+        if (success && std::rename(QFile::encodeName(file->fileName()).constData(),
+                                   QFile::encodeName(filePath).constData()) == 0) {
+            QFile::remove(statePath(filePath));
+            state = Done;
+        } else if (success) {
+            error = tr("Failed rename to %1\n%2").arg(filePath, qt_error_string(errno));
+        }
+
+        if (state == Done) {
+            progress.setRange(0, 1);
+            progress.setValue(1);
+            progress.setFormat(QString("done [%1]").arg(bytesToKMG(received)));
             setProgressBarColor(Qt::gray);
             actionButton.setText("open");
-        } else {
-            progress.setFormat(QString("%p% [%1] %2").arg(bytesToKMG(progress.maximum()))
-                                                     .arg(reply->errorString()));
-            setProgressBarColor(Qt::darkRed);
-            actionButton.setText("retry");
+            return;
         }
 
-        if (reply->error() && reply->error() != QNetworkReply::OperationCanceledError) {
+        progress.setFormat(QString("%p% [%1] %2").arg(bytesToKMG(total)).arg(error));
+        setProgressBarColor(Qt::darkRed);
+        actionButton.setText("retry");
+
+        if (!canceled) {
             QMessageBox message(QMessageBox::Critical,
-                                reply->url().toString(),
-                                tr("Failed download\n%1").arg(reply->errorString()),
+                                request.url().toString(),
+                                tr("Failed download\n%1").arg(error),
                                 QMessageBox::Retry | QMessageBox::Abort,
                                 this);
             if (message.exec() == QMessageBox::Retry)
@@ -155,10 +624,15 @@ Q_OBJECT
     }
 
 public:
-    TortaDownload(QWidget *parent, QNetworkReply *reply, const QString &filePath)
-            : QWidget(parent), reply(reply), layout(this), progress(this),
-              actionButton("cancel", this), clearButton("clear", this) {
+    TortaDownload(QWidget *parent, TortaScheduler<TortaDownload> &scheduler,
+                  const QNetworkRequest &request, QFile *file, const QString &filePath,
+                  int connections)
+            : QWidget(parent), scheduler(scheduler), request(request), file(file),
+              filePath(filePath), connections(connections), layout(this), progress(this),
+              actionButton("cancel", this), pauseButton("pause", this),
+              firstButton("first", this), clearButton("clear", this) {
         setLayout(&layout);
+        file->setParent(this);
 
         auto horizontal = new QHBoxLayout;
         layout.addLayout(horizontal);
@@ -171,39 +645,125 @@ public:
         path->setWordWrap(true);
         left->addWidget(path);
 
-        auto url = new QLabel(QString("<a href=\"%1\">%1</a>").arg(reply->url().toString()), this);
+        auto url = new QLabel(QString("<a href=\"%1\">%1</a>").arg(request.url().toString()),
+                              this);
         url->setOpenExternalLinks(true);
         url->setWordWrap(true);
         left->addWidget(url);
 
+        horizontal->addWidget(&firstButton);
+        horizontal->addWidget(&pauseButton);
         horizontal->addWidget(&actionButton);
         horizontal->addWidget(&clearButton);
         clearButton.hide();
-        connect(&actionButton, &QPushButton::clicked, [this, reply, filePath]{
-            if (reply->isRunning())
-                reply->abort();
-            else if (reply->error())
+        connect(&actionButton, &QPushButton::clicked, [this]{
+            if (state == Done) {
+                QDesktopServices::openUrl(QUrl::fromLocalFile(this->filePath));
+            } else if (state == Failed) {
                 emit retry();
+            } else {
+                canceled = true;
+                fail(tr("Operation canceled"));
+            }
+        });
+        connect(&pauseButton, &QPushButton::clicked, [this]{
+            if (state == Paused)
+                this->scheduler.resume(this);
             else
-                QDesktopServices::openUrl(QUrl("file://" + filePath));
+                this->scheduler.pause(this);
+        });
+        connect(&firstButton, &QPushButton::clicked, [this]{ this->scheduler.prioritize(this); });
+        connect(&clearButton,  &QPushButton::clicked, [this]{
+            if (state != Done) {
+                file->remove();
+                QFile::remove(statePath(this->filePath));
+            }
+            emit clear();
         });
-        connect(&clearButton,  &QPushButton::clicked, [this]{ emit clear(); });
 
-        progress.setFormat("%p% [%vB / %mB]");
+        progress.setRange(0, 0);
+        progress.setFormat("%p%");
         setProgressBarColor(Qt::darkGray);
         layout.addWidget(&progress);
 
-        connect(reply, &QNetworkReply::downloadProgress, [this](qint64 received, qint64 total){
+        intervalTimer.setSingleShot(false);
+        connect(&intervalTimer, &QTimer::timeout, [this]{
             updateProgressFormat();
-
-            progress.setRange(0, total);
-            progress.setValue(received);
+            if (segmented()) {
+                file->flush();
+                saveState();
+            }
         });
-        connect(reply, &QNetworkReply::finished, [this, filePath]{ finished(filePath); });
-        intervalTimer.setSingleShot(false);
-        connect(&intervalTimer, &QTimer::timeout, this, &TortaDownload::updateProgressFormat);
+    }
+
+    QString host() const {
+        return request.url().host();
+    }
+
+    void queued(int position) {
+        state = position > 0 ? Queued : Paused;
+        pauseButton.setText(state == Paused ? "resume" : "pause");
+        firstButton.setVisible(position > 1);
+        const QString label(state == Paused ? QString("paused")
+                                            : QString("queued #%1").arg(position));
+        progress.setRange(0, total > 0 ? 1000 : 0);
+        progress.setValue(total > 0 ? received * 1000 / total : 0);
+        progress.setFormat("%p% " + QString("[%1 / %2] %3").arg(bytesToKMG(received))
+                                                           .arg(bytesToKMG(total))
+                                                           .arg(label));
+    }
+
+    void pause() {
+        if (state == Running)
+            stop();
+    }
+
+    void drain() {
+        for (const Segment &segment: QVector<Segment>(segments))
+            write(segment.reply);
+    }
+
+    void start() {
+        state = Running;
+        pauseButton.setText("pause");
+        firstButton.hide();
         intervalTimer.start(1000);
         elapsedTimer.start();
+        offset = received = 0;
+        total = -1;
+
+        QFile stateFile(statePath(filePath));
+        const QJsonObject saved(stateFile.open(QIODevice::ReadOnly)
+                                ? QJsonDocument::fromJson(stateFile.readAll()).object()
+                                : QJsonObject());
+        const QJsonArray ranges(saved["segments"].toArray());
+        const qint64 size = saved["size"].toDouble();
+        validator = saved["validator"].toString().toLatin1();
+
+        if (file->size() == 0 || validator.isEmpty()
+                || saved["url"].toString() != request.url().toString()
+                || (saved.contains("segments") && (ranges.isEmpty() || file->size() != size))) {
+            validator.clear();
+            if (connections > 1) {
+                probe();
+            } else {
+                file->resize(0);
+                fetch(0, -1);
+            }
+        } else if (saved.contains("segments")) {
+            total = received = size;
+            for (const QJsonValue &range: ranges) {
+                const qint64 pos = range.toArray()[0].toDouble();
+                const qint64 end = range.toArray()[1].toDouble();
+                received -= end - pos;
+                fetch(pos, end);
+            }
+            offset = received;
+        } else {
+            offset = received = file->size();
+            fetch(file->size(), -1);
+        }
+        updateProgress();
     }
 
 signals:
@@ -212,10 +772,10 @@ signals:
 
 private slots:
     void updateProgressFormat() {
-        const int remain = qMax(
+        const int remain = received <= offset || total <= 0 ? 0 : qMax(
             0.0f,
-            ((progress.maximum() * elapsedTimer.elapsed()) / static_cast<float>(progress.value())
-            - elapsedTimer.elapsed()) / 1000
+            (total - received) * elapsedTimer.elapsed() / static_cast<float>(received - offset)
+            / 1000
         );
 
         QString remainStr;
@@ -226,8 +786,8 @@ private slots:
         else
             remainStr = QString("%1:%2'").arg(remain/60/60).arg(remain/60 % 60, 2, 'd', 0, '0');
 
-        progress.setFormat("%p% " + QString("[%1 / %2] %3").arg(bytesToKMG(progress.value()))
-                                                           .arg(bytesToKMG(progress.maximum()))
+        progress.setFormat("%p% " + QString("[%1 / %2] %3").arg(bytesToKMG(received))
+                                                           .arg(bytesToKMG(total))
                                                            .arg(remainStr));
     }
 };
@@ -237,8 +797,10 @@ class TortaDL : public QScrollArea {
 Q_OBJECT
 
     QVBoxLayout layout;
-    QNetworkAccessManager manager;
+    QLabel status;
+    TortaScheduler<TortaDownload> scheduler;
     TortaRequestHandler * const handler;
+    const int connections;
 
 protected:
     void closeEvent(QCloseEvent *e) override {
@@ -247,41 +809,94 @@ protected:
     }
   
 public:
-    TortaDL(TortaRequestHandler *handler) : handler(handler) {
+    TortaDL(TortaRequestHandler *handler, const QCommandLineParser &parser)
+            : scheduler(status, parser.value("max-downloads").toInt(),
+                        parser.value("max-per-host").toInt(),
+                        parser.value("limit").toLongLong() * 1024,
+                        parser.value("limit-per-download").toLongLong() * 1024),
+              handler(handler), connections(qMax(1, parser.value("connections").toInt())) {
         setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
         layout.setAlignment(Qt::AlignTop);
+        layout.addWidget(&status);
         auto listArea = new QWidget(this);
         listArea->setLayout(&layout);
         setWidget(listArea);
         setWidgetResizable(true);
 
-        connect(handler, &TortaRequestHandler::receivedRequest,
-                [this](const QUrl &url){ startDownload(url); });
+        connect(handler, &TortaRequestHandler::receivedRequests,
+                [this](const QVector<TortaRequest> &requests){
+            for (const TortaRequest &request: requests)
+                startDownload(request);
+        });
     }
 
-    void startDownload(QUrl url, const QString &fname) {
-        if (url.scheme().isEmpty()) {
-            url = QUrl("http://" + url.toString());
+    bool startDownload(const QNetworkRequest &request, const QString &fname) {
+        const QUrl url(request.url());
+        auto file = new QFile(fname + ".part");
+        while (!file->open(QIODevice::ReadWrite)) {
+            QMessageBox message(QMessageBox::Critical,
+                                url.toString(),
+                                tr("Failed create %1\n%2").arg(file->fileName(),
+                                                               file->errorString()),
+                                QMessageBox::Retry | QMessageBox::Abort,
+                                this);
+            if (message.exec() != QMessageBox::Retry) {
+                delete file;
+                return false;
+            }
         }
 
-        QNetworkRequest request(url);
-        request.setRawHeader("User-Agent", USER_AGENT);
-
-        auto dl = new TortaDownload(widget(), manager.get(request), fname);
+        auto dl = new TortaDownload(widget(), scheduler, request, file, fname, connections);
 
         layout.addWidget(dl);
 
-        connect(dl, &TortaDownload::retry, [this, dl, url, fname]{
+        connect(dl, &TortaDownload::retry, [this, dl, request, fname]{
             layout.removeWidget(dl);
-            startDownload(url, fname);
+            dl->deleteLater();
+            startDownload(request, fname);
         });
         connect(dl, &TortaDownload::clear, [this, dl]{
             layout.removeWidget(dl);
             delete dl;
         });
+
+        scheduler.enqueue(dl);
+        return true;
     }
 
-    bool startDownload(const QUrl &url) {
+    bool startDownload(const TortaRequest &source) {
+        QUrl url(source.url);
+        if (url.scheme().isEmpty()) {
+            url = QUrl("http://" + url.toString());
+        }
+
+        QNetworkRequest request(url);
+        request.setRawHeader("User-Agent", USER_AGENT);
+        request.setAttribute(QNetworkRequest::RedirectPolicyAttribute,
+                             QNetworkRequest::NoLessSafeRedirectPolicy);
+        if (!source.referrer.isEmpty())
+            request.setRawHeader("Referer", source.referrer.toEncoded());
+        for (const auto &header: source.headers) {
+            if (header.first.toLower() != "cookie") {
+                request.setRawHeader(header.first, header.second);
+                continue;
+            }
+
+            for (const QByteArray &pair: header.second.split(';')) {
+                const int separator = pair.indexOf('=');
+                if (separator <= 0 || pair.left(separator).trimmed().isEmpty())
+                    continue;
+                QNetworkCookie cookie(pair.left(separator).trimmed(),
+                                      pair.mid(separator + 1).trimmed());
+                cookie.setDomain(url.host());
+                cookie.setPath("/");
+                scheduler.cookieJar()->insertCookie(cookie);
+            }
+        }
+
+        if (!source.path.isEmpty())
+            return startDownload(request, source.path);
+
         const QString filter(QMimeDatabase().mimeTypeForFile(url.fileName()).filterString());
         const QString path(QFileDialog::getSaveFileName(
             this,
@@ -289,9 +904,7 @@ public:
             QFileInfo(QFileDialog().directory(), url.fileName()).absoluteFilePath(),
             filter + tr(";; All files (*)")
         ));
-        if (path != "")
-            startDownload(url, path);
-        return path != "";
+        return path != "" && startDownload(request, path);
     }
 };
 
@@ -306,20 +919,56 @@ int main(int argc, char **argv) {
     parser.addPositionalArgument("URL...", "URL that you want download.");
     parser.addHelpOption();
     parser.addVersionOption();
+    parser.addOption(QCommandLineOption("connections", "connections per download of large files",
+                                        "n", QString::number(DOWNLOAD_CONNECTIONS)));
+    parser.addOption(QCommandLineOption("max-downloads", "downloads at once (0 is unlimited)",
+                                        "n", QString::number(DOWNLOAD_MAX)));
+    parser.addOption(QCommandLineOption("max-per-host",
+                                        "downloads at once from a host (0 is unlimited)",
+                                        "n", QString::number(DOWNLOAD_MAX_PER_HOST)));
+    parser.addOption(QCommandLineOption("limit", "total bandwidth (0 is unlimited)",
+                                        "KB/s", "0"));
+    parser.addOption(QCommandLineOption("limit-per-download",
+                                        "bandwidth of each download (0 is unlimited)",
+                                        "KB/s", "0"));
+    parser.addOption(QCommandLineOption("requests",
+                                        "read requests sent by the browser from file (- is stdin)",
+                                        "file"));
     parser.process(app.arguments());
 
-    if (parser.positionalArguments().empty())
+    if (parser.positionalArguments().empty() && !parser.isSet("requests"))
         parser.showHelp(-1);
 
+    QVector<TortaRequest> requests;
+    for (auto url: parser.positionalArguments())
+        requests << TortaRequest{QUrl(url), QString(), QUrl(), {}};
+
+    if (parser.isSet("requests")) {
+        QFile input(parser.value("requests"));
+        const bool opened = parser.value("requests") == "-"
+                            ? input.open(stdin, QIODevice::ReadOnly)
+                            : input.open(QIODevice::ReadOnly);
+        QByteArray payload;
+        QVector<TortaRequest> batch;
+        while (opened && TortaRequest::readFrame(&input, payload)
+                      && TortaRequest::unpack(payload, batch))
+            requests << batch;
+
+        if (requests.isEmpty()) {
+            qCritical().noquote() << "no requests in" << parser.value("requests");
+            return 1;
+        }
+    }
+
     auto handler = TortaRequestHandler::open();
     if (handler == nullptr)
-        return TortaRequestHandler::request(parser.positionalArguments()) ? 0 : 2;
+        return TortaRequestHandler::request(requests) ? 0 : 2;
 
-    TortaDL win(handler);
+    TortaDL win(handler, parser);
 
     bool started = false;
-    for (auto url: parser.positionalArguments())
-        started = started || win.startDownload({url});
+    for (const TortaRequest &request: requests)
+        started = win.startDownload(request) || started;
 
     if (!started) {
         win.close();
@@ -0,0 +1,74 @@
+#ifndef TORTA_REQUEST_H
+#define TORTA_REQUEST_H
+
+#include <QtCore>
+
+
+#define DOWNLOADER_CONNECTION_NAME  "dobostorta-downloader.sock"
+#define DOWNLOADER_PROTOCOL         1
+
+
+struct TortaRequest {
+    QUrl url;
+    QString path;
+    QUrl referrer;
+    QList<QPair<QByteArray, QByteArray>> headers;
+
+
+    friend QDataStream &operator<<(QDataStream &stream, const TortaRequest &request) {
+        return stream << request.url << request.path << request.referrer << request.headers;
+    }
+
+    friend QDataStream &operator>>(QDataStream &stream, TortaRequest &request) {
+        return stream >> request.url >> request.path >> request.referrer >> request.headers;
+    }
+
+    static QByteArray frame(const QByteArray &payload) {
+        QByteArray block;
+        QDataStream stream(&block, QIODevice::WriteOnly);
+        stream << payload;
+        return block;
+    }
+
+    static QByteArray pack(const QVector<TortaRequest> &requests) {
+        QByteArray payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream << quint8(DOWNLOADER_PROTOCOL) << requests;
+        return frame(payload);
+    }
+
+    static bool unpack(const QByteArray &payload, QVector<TortaRequest> &requests) {
+        QDataStream stream(payload);
+        quint8 version = 0;
+        stream >> version;
+        if (version != DOWNLOADER_PROTOCOL)
+            return false;
+        stream >> requests;
+        return stream.status() == QDataStream::Ok;
+    }
+
+    static QByteArray packAck(const QVector<bool> &accepted) {
+        QByteArray payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream << quint8(DOWNLOADER_PROTOCOL) << accepted;
+        return frame(payload);
+    }
+
+    static bool unpackAck(const QByteArray &payload, QVector<bool> &accepted) {
+        QDataStream stream(payload);
+        quint8 version = 0;
+        stream >> version >> accepted;
+        return version == DOWNLOADER_PROTOCOL && stream.status() == QDataStream::Ok;
+    }
+
+    // Reads one length-prefixed frame, or returns false until the whole frame has arrived.
+    static bool readFrame(QIODevice *device, QByteArray &payload) {
+        QDataStream stream(device);
+        stream.startTransaction();
+        stream >> payload;
+        return stream.commitTransaction();
+    }
+};
+
+
+#endif
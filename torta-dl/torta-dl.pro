@@ -8,4 +8,5 @@ DEFINES += GIT_VERSION=\\\"$$system(git describe --always --tags --dirty)\\\"
 
 QT += widgets network
 
+HEADERS += request.h
 SOURCES += main.cpp